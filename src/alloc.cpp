@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "alloc.h"
+#include "phase.h"
+
+#ifdef ALLOC_PROFILE
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <new>
+#include <string.h>
+#include <unistd.h>
+
+/* The allocation profiler replaces malloc and friends, as well as the C++
+ * operator new and delete, with versions that put a small header in front
+ * of every block. The header records the size of the block, the phase that
+ * allocated it and the call site that asked for it, so each allocation and
+ * each free can be charged to a (call site, phase) pair. Whatever has not
+ * been freed at exit is reported as a leak.
+ *
+ * The real blocks come from glibc's __libc_* entry points. The profiler's
+ * own tables are static arrays, as it cannot allocate from itself. Blocks
+ * allocated while the report is printed are marked as untracked.
+ */
+
+#define ALLOC_MAGIC 0xa5
+#define ALLOC_ALIGN 16
+#define MAX_SITES 4096
+#define TOP_SITES 25
+
+typedef struct {
+	size_t size;
+	unsigned short site;
+	unsigned char phase;
+	unsigned char magic;
+	unsigned int offset;
+} alloc_header_t;
+
+typedef struct {
+	void* addr;
+	long count[PHASE_COUNT];
+	long bytes[PHASE_COUNT];
+	long live_count[PHASE_COUNT];
+	long live_bytes[PHASE_COUNT];
+} alloc_site_t;
+
+extern "C" {
+	void* __libc_malloc(size_t size);
+	void* __libc_memalign(size_t align, size_t size);
+	void __libc_free(void* ptr);
+}
+
+static void* profile_alloc(size_t size, size_t align, void* caller);
+static void profile_free(void* ptr);
+static unsigned short find_site(void* addr);
+static void report();
+static void report_site(alloc_site_t* site, long bytes, long count, long live);
+static int site_cmp(const void* a, const void* b);
+
+static int report_at_exit = 0;
+static int reporting = 0;
+static int num_sites = 1;
+static alloc_site_t sites[MAX_SITES];
+static unsigned short site_index[MAX_SITES * 2];
+static int order[MAX_SITES];
+
+void alloc_profile_enable() {
+	if (!report_at_exit) atexit(report);
+	report_at_exit = 1;
+
+	return;
+}
+
+void* profile_alloc(size_t size, size_t align, void* caller) {
+	int phase;
+	char* block;
+	alloc_header_t* header;
+	unsigned short site;
+
+	if (align < ALLOC_ALIGN) align = ALLOC_ALIGN;
+	if (size > (size_t) -1 - align) return NULL;
+
+	if (align == ALLOC_ALIGN) {
+		block = (char*) __libc_malloc(size + align);
+	} else {
+		block = (char*) __libc_memalign(align, size + align);
+	}
+	if (block == NULL) return NULL;
+
+	phase = reporting ? PHASE_COUNT : phase_current();
+	site = reporting ? 0 : find_site(caller);
+
+	header = (alloc_header_t*) (block + align - sizeof(alloc_header_t));
+	header->size = size;
+	header->site = site;
+	header->phase = phase;
+	header->magic = ALLOC_MAGIC;
+	header->offset = align;
+
+	if (!reporting) {
+		sites[site].count[phase]++;
+		sites[site].bytes[phase] += size;
+		sites[site].live_count[phase]++;
+		sites[site].live_bytes[phase] += size;
+	}
+
+	return block + align;
+}
+
+void profile_free(void* ptr) {
+	alloc_header_t* header;
+
+	if (ptr == NULL) return;
+
+	header = (alloc_header_t*) ((char*) ptr - sizeof(alloc_header_t));
+	if (header->magic != ALLOC_MAGIC) {
+		fprintf(stderr, "ALLOC PROFILE: free of unknown block %p\n", ptr);
+		abort();
+	}
+
+	if (header->phase < PHASE_COUNT) {
+		sites[header->site].live_count[header->phase]--;
+		sites[header->site].live_bytes[header->phase] -= header->size;
+	}
+	header->magic = 0;
+
+	__libc_free((char*) ptr - header->offset);
+
+	return;
+}
+
+/* Call sites are kept in an open addressing hash table of indexes into the
+ * site array. Site 0 collects everything once the table is full.
+ */
+unsigned short find_site(void* addr) {
+	unsigned long slot;
+
+	slot = ((unsigned long) addr >> 2) % (MAX_SITES * 2);
+	while (site_index[slot]) {
+		if (sites[site_index[slot]].addr == addr) return site_index[slot];
+		slot = (slot + 1) % (MAX_SITES * 2);
+	}
+
+	if (num_sites == MAX_SITES) return 0;
+
+	sites[num_sites].addr = addr;
+	site_index[slot] = num_sites;
+
+	return num_sites++;
+}
+
+void report() {
+	int i;
+	int p;
+	long count;
+	long bytes;
+	long live_count;
+	long live_bytes;
+
+	reporting = 1;
+
+	fprintf(stderr, "\n===========  Allocation Profile  ===========\n");
+	fprintf(stderr, "%-12s %10s %12s %10s %12s\n", "phase", "allocs", "bytes",
+		"leaked", "leaked bytes");
+
+	for (p = 0; p < PHASE_COUNT; p++) {
+		count = bytes = live_count = live_bytes = 0;
+		for (i = 0; i < num_sites; i++) {
+			count += sites[i].count[p];
+			bytes += sites[i].bytes[p];
+			live_count += sites[i].live_count[p];
+			live_bytes += sites[i].live_bytes[p];
+		}
+		fprintf(stderr, "%-12s %10li %12li %10li %12li\n",
+			phase_name((phase_t) p), count, bytes, live_count, live_bytes);
+	}
+
+	for (i = 0; i < num_sites; i++) order[i] = i;
+	qsort(order, num_sites, sizeof(int), site_cmp);
+
+	fprintf(stderr, "\nTop call sites by bytes allocated:\n");
+	fprintf(stderr, "%-12s %10s %12s %12s  %s\n", "phase", "allocs", "bytes",
+		"leaked bytes", "site");
+
+	for (i = 0; i < num_sites && i < TOP_SITES; i++) {
+		for (p = 0; p < PHASE_COUNT; p++) {
+			if (sites[order[i]].count[p] == 0) continue;
+			fprintf(stderr, "%-12s ", phase_name((phase_t) p));
+			report_site(&sites[order[i]], sites[order[i]].bytes[p],
+				sites[order[i]].count[p], sites[order[i]].live_bytes[p]);
+		}
+	}
+
+	fprintf(stderr, "===========  ==================  ===========\n");
+
+	return;
+}
+
+void report_site(alloc_site_t* site, long bytes, long count, long live) {
+	int status;
+	char* name;
+	Dl_info info;
+
+	fprintf(stderr, "%10li %12li %12li  ", count, bytes, live);
+
+	if (site->addr == NULL) {
+		fprintf(stderr, "(other sites)\n");
+	} else if (dladdr(site->addr, &info) && info.dli_sname) {
+		name = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+		fprintf(stderr, "%s+0x%lx (%s)\n", status == 0 ? name : info.dli_sname,
+			(unsigned long) ((char*) site->addr - (char*) info.dli_saddr),
+			info.dli_fname);
+		free(name);
+	} else if (dladdr(site->addr, &info) && info.dli_fname) {
+		fprintf(stderr, "%s+0x%lx\n", info.dli_fname,
+			(unsigned long) ((char*) site->addr - (char*) info.dli_fbase));
+	} else {
+		fprintf(stderr, "%p\n", site->addr);
+	}
+
+	return;
+}
+
+int site_cmp(const void* a, const void* b) {
+	int p;
+	long total_a;
+	long total_b;
+
+	total_a = 0;
+	total_b = 0;
+	for (p = 0; p < PHASE_COUNT; p++) {
+		total_a += sites[*(const int*) a].bytes[p];
+		total_b += sites[*(const int*) b].bytes[p];
+	}
+
+	if (total_a == total_b) return 0;
+
+	return total_a < total_b ? 1 : -1;
+}
+
+extern "C" {
+
+void* malloc(size_t size) {
+	return profile_alloc(size, ALLOC_ALIGN, __builtin_return_address(0));
+}
+
+void* calloc(size_t num, size_t size) {
+	void* ptr;
+
+	if (size && num > (size_t) -1 / size) return NULL;
+
+	ptr = profile_alloc(num * size, ALLOC_ALIGN, __builtin_return_address(0));
+	if (ptr) memset(ptr, 0, num * size);
+
+	return ptr;
+}
+
+void* realloc(void* ptr, size_t size) {
+	void* block;
+	alloc_header_t* header;
+
+	block = profile_alloc(size, ALLOC_ALIGN, __builtin_return_address(0));
+	if (block == NULL || ptr == NULL) return block;
+
+	header = (alloc_header_t*) ((char*) ptr - sizeof(alloc_header_t));
+	memcpy(block, ptr, header->size < size ? header->size : size);
+	profile_free(ptr);
+
+	return block;
+}
+
+void free(void* ptr) {
+	profile_free(ptr);
+}
+
+void* memalign(size_t align, size_t size) {
+	return profile_alloc(size, align, __builtin_return_address(0));
+}
+
+void* aligned_alloc(size_t align, size_t size) {
+	return profile_alloc(size, align, __builtin_return_address(0));
+}
+
+int posix_memalign(void** ptr, size_t align, size_t size) {
+	*ptr = profile_alloc(size, align, __builtin_return_address(0));
+
+	return *ptr ? 0 : ENOMEM;
+}
+
+void* valloc(size_t size) {
+	return profile_alloc(size, sysconf(_SC_PAGESIZE),
+		__builtin_return_address(0));
+}
+
+void* pvalloc(size_t size) {
+	return profile_alloc(size, sysconf(_SC_PAGESIZE),
+		__builtin_return_address(0));
+}
+
+/* strdup is replaced too, so that copies are charged to their caller rather
+ * than to the C library.
+ */
+char* strdup(const char* str) {
+	char* copy;
+	size_t len;
+
+	len = strlen(str) + 1;
+	copy = (char*) profile_alloc(len, ALLOC_ALIGN, __builtin_return_address(0));
+	if (copy) memcpy(copy, str, len);
+
+	return copy;
+}
+
+char* strndup(const char* str, size_t max) {
+	char* copy;
+	size_t len;
+
+	for (len = 0; len < max && str[len]; len++);
+	copy = (char*) profile_alloc(len + 1, ALLOC_ALIGN,
+		__builtin_return_address(0));
+	if (copy) {
+		memcpy(copy, str, len);
+		copy[len] = '\0';
+	}
+
+	return copy;
+}
+
+size_t malloc_usable_size(void* ptr) {
+	if (ptr == NULL) return 0;
+
+	return ((alloc_header_t*) ((char*) ptr - sizeof(alloc_header_t)))->size;
+}
+
+}
+
+void* operator new(size_t size) throw(std::bad_alloc) {
+	void* ptr;
+
+	ptr = profile_alloc(size, ALLOC_ALIGN, __builtin_return_address(0));
+	if (ptr == NULL) throw std::bad_alloc();
+
+	return ptr;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc) {
+	void* ptr;
+
+	ptr = profile_alloc(size, ALLOC_ALIGN, __builtin_return_address(0));
+	if (ptr == NULL) throw std::bad_alloc();
+
+	return ptr;
+}
+
+void operator delete(void* ptr) throw() {
+	profile_free(ptr);
+}
+
+void operator delete[](void* ptr) throw() {
+	profile_free(ptr);
+}
+
+#else
+
+void alloc_profile_enable() {
+	fprintf(stderr, "WARNING: allocation profiling is not available, ");
+	fprintf(stderr, "rebuild with 'make rebuild ALLOC_PROFILE=1'.\n");
+
+	return;
+}
+
+#endif /* ALLOC_PROFILE */
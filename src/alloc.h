@@ -0,0 +1,6 @@
+#ifndef _ALLOC_H_
+#define _ALLOC_H_
+
+void alloc_profile_enable();
+
+#endif /* _ALLOC_H_ */
@@ -12,7 +12,11 @@ extern SymbolTable sem_symtab;
 void error_lineno(ast_t* node) {
 	errors++;
 
-	fprintf(stdout, "ERROR(%i): ", node->lineno);
+	if (node->filename) {
+		fprintf(stdout, "ERROR(%s:%i): ", node->filename, node->lineno);
+	} else {
+		fprintf(stdout, "ERROR(%i): ", node->lineno);
+	}
 
 	return;
 }
@@ -38,8 +42,13 @@ void error_symbol_defined(ast_t* node) {
 	if (!def) return;
 
 	error_lineno(node);
-	fprintf(stdout, "Symbol '%s' is already defined at line %i.\n",
-		node->data.name, def->lineno);
+	if (def->filename) {
+		fprintf(stdout, "Symbol '%s' is already defined at %s:%i.\n",
+			node->data.name, def->filename, def->lineno);
+	} else {
+		fprintf(stdout, "Symbol '%s' is already defined at line %i.\n",
+			node->data.name, def->lineno);
+	}
 
 	return;
 }
@@ -47,7 +56,11 @@ void error_symbol_defined(ast_t* node) {
 void warning_lineno(ast_t* node) {
 	warnings++;
 
-	fprintf(stdout, "WARNING(%i): ", node->lineno);
+	if (node->filename) {
+		fprintf(stdout, "WARNING(%s:%i): ", node->filename, node->lineno);
+	} else {
+		fprintf(stdout, "WARNING(%i): ", node->lineno);
+	}
 
 	return;
 }
@@ -10,6 +10,12 @@
 
 extern const char* token_name(int token_class);
 
+/* Name of the source file currently being parsed. This is only set when
+ * more than one source file is compiled, so diagnostics for single file
+ * programs keep their usual format.
+ */
+const char* ast_filename = NULL;
+
 ast_t* ast_create_node() {
 	int i;
 	ast_t* node;
@@ -18,6 +24,7 @@ ast_t* ast_create_node() {
 	assert(node != NULL);
 
 	node->lineno = 0;
+	node->filename = ast_filename;
 
 	node->type = NODE_NONE;
 	node->data.name = NULL;
@@ -30,7 +37,9 @@ ast_t* ast_create_node() {
 	node->data.is_array = 0;
 	node->data.is_const = 0;
 	node->data.is_func_body = 0;
+	node->data.is_inline = 0;
 	node->data.is_static = 0;
+	node->data.is_unused = 0;
 	node->data.int_val = 0;
 	node->data.char_val = '\0';
 	node->data.str_val = NULL;
@@ -105,6 +114,165 @@ void ast_add_child(ast_t* root, int index, ast_t* child) {
 	return;
 }
 
+/* Copies a tree, not including the siblings of its root. The copy shares
+ * the names and strings of the original.
+ */
+ast_t* ast_copy(ast_t* tree) {
+	int i;
+	ast_t* copy;
+	ast_t* child;
+	ast_t* last;
+
+	if (tree == NULL) return NULL;
+
+	copy = (ast_t*) malloc(sizeof(ast_t));
+	assert(copy != NULL);
+	*copy = *tree;
+	copy->sibling = NULL;
+
+	for (i = 0; i < tree->num_children; i++) {
+		copy->child[i] = NULL;
+		last = NULL;
+		for (child = tree->child[i]; child; child = child->sibling) {
+			if (last == NULL) {
+				copy->child[i] = last = ast_copy(child);
+			} else {
+				last = last->sibling = ast_copy(child);
+			}
+		}
+	}
+
+	return copy;
+}
+
+/* Counts the nodes in a tree, not including the siblings of its root */
+int ast_size(ast_t* tree) {
+	int i;
+	int size;
+	ast_t* child;
+
+	if (tree == NULL) return 0;
+
+	size = 1;
+	for (i = 0; i < tree->num_children; i++) {
+		for (child = tree->child[i]; child; child = child->sibling) {
+			size += ast_size(child);
+		}
+	}
+
+	return size;
+}
+
+/* Returns the value of a constant node, whatever its type */
+int ast_const_value(ast_t* node) {
+	switch (node->data.type) {
+		case TYPE_BOOL:
+			return node->data.bool_val;
+		case TYPE_CHAR:
+			return node->data.char_val;
+		default:
+			return node->data.int_val;
+	}
+}
+
+/* Checks whether evaluating an expression can have side effects, either
+ * through an assignment, a call or the random number generator behind ?
+ */
+int ast_is_pure(ast_t* tree) {
+	int i;
+	ast_t* child;
+
+	if (tree == NULL) return 1;
+
+	switch (tree->type) {
+		case NODE_ASSIGN:
+		case NODE_CALL:
+			return 0;
+		case NODE_OP:
+			if (tree->data.op == OP_QMARK) return 0;
+			break;
+	}
+
+	for (i = 0; i < tree->num_children; i++) {
+		for (child = tree->child[i]; child; child = child->sibling) {
+			if (!ast_is_pure(child)) return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Checks whether an expression is known never to be negative. A sum or
+ * product of non-negative operands is not, as it may wrap around.
+ */
+int ast_non_negative(ast_t* node) {
+	if (node->data.type == TYPE_BOOL) return 1;
+
+	switch (node->type) {
+		case NODE_CONST:
+			return ast_const_value(node) >= 0;
+		case NODE_OP:
+			break;
+		default:
+			return 0;
+	}
+
+	switch (node->data.op) {
+		case OP_SIZE:
+			return 1;
+		case OP_DIV:
+		case OP_MOD:
+			return ast_non_negative(node->child[0])
+				&& node->child[1]->type == NODE_CONST
+				&& ast_const_value(node->child[1]) > 0;
+	}
+
+	return 0;
+}
+
+/* Checks for a break out of the loop a statement list is in */
+int ast_has_break(ast_t* tree) {
+	int i;
+
+	for (; tree; tree = tree->sibling) {
+		if (tree->type == NODE_BREAK) return 1;
+		if (tree->type == NODE_WHILE) continue;
+		for (i = 0; i < tree->num_children; i++) {
+			if (ast_has_break(tree->child[i])) return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Checks whether control can reach the end of a statement */
+int ast_can_complete(ast_t* stmt) {
+	ast_t* child;
+
+	if (stmt == NULL) return 1;
+
+	switch (stmt->type) {
+		case NODE_BREAK:
+		case NODE_RETURN:
+			return 0;
+		case NODE_COMPOUND:
+			for (child = stmt->child[1]; child; child = child->sibling) {
+				if (!ast_can_complete(child)) return 0;
+			}
+			return 1;
+		case NODE_IF:
+			return stmt->child[2] == NULL || ast_can_complete(stmt->child[1])
+				|| ast_can_complete(stmt->child[2]);
+		case NODE_WHILE:
+			/* while (true) only ends through a break */
+			return stmt->child[0]->type != NODE_CONST
+				|| !ast_const_value(stmt->child[0])
+				|| ast_has_break(stmt->child[1]);
+	}
+
+	return 1;
+}
+
 const char* ast_type_string(ast_type_t type) {
 	switch(type) {
 		case TYPE_BOOL:
@@ -87,7 +87,9 @@ typedef struct {
 	int is_array;
 	int is_const;
 	int is_func_body;
+	int is_inline;
 	int is_static;
+	int is_unused;
 	int bool_val;
 	int int_val;
 	char char_val;
@@ -96,6 +98,7 @@ typedef struct {
 
 struct _ast {
 	int lineno;
+	const char* filename;
 	int num_children;
 	ast_node_t type;
 	ast_data_t data;
@@ -104,10 +107,19 @@ struct _ast {
 };
 typedef struct _ast ast_t;
 
+extern const char* ast_filename;
+
 void ast_add_sibling(ast_t* root, ast_t* sibling);
 void ast_add_child(ast_t* root, int index, ast_t* child);
 ast_t* ast_create_node();
 ast_t* ast_from_token(token_t* tok);
+ast_t* ast_copy(ast_t* tree);
+int ast_size(ast_t* tree);
+int ast_is_pure(ast_t* tree);
+int ast_non_negative(ast_t* node);
+int ast_const_value(ast_t* node);
+int ast_has_break(ast_t* tree);
+int ast_can_complete(ast_t* stmt);
 const char* ast_type_string(ast_type_t type);
 const char* ast_scope_string(ast_scope_t scope);
 
@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+#include <vector>
+#include "cache.h"
+#include "flags.h"
+
+/* The compilation cache stores the generated code and the diagnostics of a
+ * compile under a key made from the compiler, the flags and the bytes of
+ * every source file. Entries live in <dir>/<xx>/<key>, where xx is the first
+ * byte of the key, and are laid out as a one line header followed by the
+ * diagnostics and then the code:
+ *
+ *   C-CACHE 1 <has code> <diagnostics length> <code length>
+ *
+ * Entries are written to a temporary file and renamed into place, so a
+ * process never sees a partial entry. The modification time of an entry is
+ * bumped on every hit and the oldest entries are removed once the cache
+ * grows past its size limit.
+ */
+
+#define CACHE_MAGIC "C-CACHE 1"
+#define CACHE_VERSION "C- compiler version F16"
+#define CACHE_LOW_WATER 0.9
+#define HASH_OFFSET 14695981039346656037ULL
+#define HASH_PRIME 1099511628211ULL
+#define PATH_LEN 1024
+
+typedef unsigned long long cache_hash_t;
+
+typedef struct {
+	time_t mtime;
+	long size;
+	std::string path;
+} cache_entry_t;
+
+static cache_hash_t hash_bytes(cache_hash_t hash, const void* data, size_t len);
+static int read_file(const char* path, std::string& data);
+static int make_dirs(const char* path);
+static void update_stats(int hit);
+static void read_stats(long* hits, long* misses);
+static void list_entries(std::vector<cache_entry_t>& entries);
+static int is_shard(const char* name);
+static void evict();
+static void release();
+static bool entry_older(const cache_entry_t& a, const cache_entry_t& b);
+
+extern flags_t flags;
+
+static std::string cache_dir;
+static std::string entry_path;
+static long cache_max;
+static int saved_stdout = -1;
+static FILE* capture = NULL;
+
+void cache_init(const char* dir, long max_bytes) {
+	const char* home;
+
+	if (dir) {
+		cache_dir = dir;
+	} else if (getenv("CMINUS_CACHE_DIR")) {
+		cache_dir = getenv("CMINUS_CACHE_DIR");
+	} else {
+		home = getenv("HOME");
+		cache_dir = std::string(home ? home : ".") + "/.cache/c-";
+	}
+
+	cache_max = max_bytes;
+	entry_path = "";
+
+	return;
+}
+
+/* Look up the compilation of the given files. On a hit the cached
+ * diagnostics are written to stdout, the cached code is written to
+ * fout_name and 1 is returned. On a miss stdout is captured so that
+ * cache_store() can save the diagnostics of the compile that follows.
+ */
+int cache_fetch(char** files, int nfiles, const char* fout_name) {
+	int i;
+	int fd;
+	int has_code;
+	long diag_len;
+	long code_len;
+	char* map;
+	char* body;
+	char key[17];
+	char header[80];
+	struct stat st;
+	cache_hash_t hash;
+	std::string src;
+	FILE* fout;
+
+	if (nfiles == 0) return 0;
+
+	hash = hash_bytes(HASH_OFFSET, CACHE_VERSION, strlen(CACHE_VERSION));
+	if (stat("/proc/self/exe", &st) == 0) {
+		hash = hash_bytes(hash, &st.st_mtime, sizeof(st.st_mtime));
+		hash = hash_bytes(hash, &st.st_size, sizeof(st.st_size));
+	}
+	hash = hash_bytes(hash, &flags, sizeof(flags));
+	hash = hash_bytes(hash, &nfiles, sizeof(nfiles));
+
+	for (i = 0; i < nfiles; i++) {
+		if (!read_file(files[i], src)) return 0;
+		/* diagnostics carry file names when several files are compiled */
+		if (nfiles > 1) hash = hash_bytes(hash, files[i], strlen(files[i]) + 1);
+		hash = hash_bytes(hash, src.data(), src.size());
+		hash = hash_bytes(hash, "", 1);
+	}
+
+	sprintf(key, "%016llx", hash);
+	entry_path = cache_dir + "/" + std::string(key, 2) + "/" + key;
+
+	fd = open(entry_path.c_str(), O_RDONLY);
+	if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+		map = (char*) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		fd = -1;
+
+		if (map != MAP_FAILED) {
+			body = (char*) memchr(map, '\n', st.st_size);
+			if (body && body - map < (long) sizeof(header)) {
+				memcpy(header, map, body - map);
+				header[body - map] = '\0';
+				body++;
+			} else {
+				body = NULL;
+			}
+
+			if (body
+				&& !strncmp(header, CACHE_MAGIC, strlen(CACHE_MAGIC))
+				&& sscanf(header + strlen(CACHE_MAGIC), "%i %li %li",
+					&has_code, &diag_len, &code_len) == 3
+				&& body + diag_len + code_len == map + st.st_size
+			) {
+				fout = has_code ? fopen(fout_name, "w") : NULL;
+				if (!has_code || fout) {
+					if (fout) {
+						fwrite(body + diag_len, 1, code_len, fout);
+						fclose(fout);
+					}
+					fwrite(body, 1, diag_len, stdout);
+					fflush(stdout);
+					munmap(map, st.st_size);
+					utime(entry_path.c_str(), NULL);
+					update_stats(1);
+					return 1;
+				}
+			}
+
+			munmap(map, st.st_size);
+		}
+	}
+	if (fd >= 0) close(fd);
+
+	update_stats(0);
+
+	/* capture stdout until the compile is stored */
+	fflush(stdout);
+	capture = tmpfile();
+	if (capture == NULL) return 0;
+	saved_stdout = dup(fileno(stdout));
+	dup2(fileno(capture), fileno(stdout));
+	atexit(release);
+
+	return 0;
+}
+
+/* Store the diagnostics captured since cache_fetch() and the code in
+ * fout_name, which is NULL when the compile produced no code.
+ */
+void cache_store(const char* fout_name) {
+	int fd;
+	std::string diag;
+	std::string code;
+	std::string tmp_path;
+	char header[80];
+	char pid[20];
+	long len;
+
+	if (capture == NULL) return;
+
+	fflush(stdout);
+	dup2(saved_stdout, fileno(stdout));
+	close(saved_stdout);
+	saved_stdout = -1;
+
+	fseek(capture, 0, SEEK_END);
+	len = ftell(capture);
+	diag.resize(len);
+	rewind(capture);
+	if (len > 0 && fread(&diag[0], 1, len, capture) != (size_t) len) len = -1;
+	fclose(capture);
+	capture = NULL;
+
+	fwrite(diag.data(), 1, diag.size(), stdout);
+	fflush(stdout);
+
+	if (len < 0) return;
+	if (fout_name && !read_file(fout_name, code)) return;
+
+	sprintf(header, "%s %i %li %li\n", CACHE_MAGIC, fout_name ? 1 : 0,
+		(long) diag.size(), (long) code.size());
+	sprintf(pid, ".tmp.%i", (int) getpid());
+
+	if (!make_dirs(entry_path.substr(0, entry_path.rfind('/')).c_str())) return;
+
+	tmp_path = entry_path + pid;
+	fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return;
+
+	if (write(fd, header, strlen(header)) != (ssize_t) strlen(header)
+		|| write(fd, diag.data(), diag.size()) != (ssize_t) diag.size()
+		|| write(fd, code.data(), code.size()) != (ssize_t) code.size()
+	) {
+		close(fd);
+		unlink(tmp_path.c_str());
+		return;
+	}
+	close(fd);
+
+	if (rename(tmp_path.c_str(), entry_path.c_str()) != 0) {
+		unlink(tmp_path.c_str());
+		return;
+	}
+
+	evict();
+
+	return;
+}
+
+void cache_print_stats() {
+	long hits;
+	long misses;
+	long size;
+	std::vector<cache_entry_t> entries;
+	std::vector<cache_entry_t>::iterator entry;
+
+	read_stats(&hits, &misses);
+	list_entries(entries);
+
+	size = 0;
+	for (entry = entries.begin(); entry != entries.end(); entry++) {
+		size += entry->size;
+	}
+
+	fprintf(stdout, "cache directory: %s\n", cache_dir.c_str());
+	fprintf(stdout, "cache hits: %li\n", hits);
+	fprintf(stdout, "cache misses: %li\n", misses);
+	fprintf(stdout, "cache entries: %i\n", (int) entries.size());
+	fprintf(stdout, "cache size: %li bytes (max %li)\n", size, cache_max);
+
+	return;
+}
+
+cache_hash_t hash_bytes(cache_hash_t hash, const void* data, size_t len) {
+	size_t i;
+	const unsigned char* bytes;
+
+	bytes = (const unsigned char*) data;
+	for (i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= HASH_PRIME;
+	}
+
+	return hash;
+}
+
+int read_file(const char* path, std::string& data) {
+	FILE* fin;
+	char buf[4096];
+	size_t len;
+
+	fin = fopen(path, "r");
+	if (fin == NULL) return 0;
+
+	data.clear();
+	while ((len = fread(buf, 1, sizeof(buf), fin)) > 0) {
+		data.append(buf, len);
+	}
+	fclose(fin);
+
+	return 1;
+}
+
+int make_dirs(const char* path) {
+	char buf[PATH_LEN];
+	char* p;
+
+	if (strlen(path) >= sizeof(buf)) return 0;
+	strcpy(buf, path);
+
+	for (p = buf + 1; *p; p++) {
+		if (*p != '/') continue;
+		*p = '\0';
+		mkdir(buf, 0755);
+		*p = '/';
+	}
+	mkdir(buf, 0755);
+
+	return access(buf, W_OK) == 0;
+}
+
+void update_stats(int hit) {
+	int fd;
+	long hits;
+	long misses;
+	char buf[80];
+	ssize_t len;
+
+	if (!make_dirs(cache_dir.c_str())) return;
+
+	fd = open((cache_dir + "/stats").c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0) return;
+	flock(fd, LOCK_EX);
+
+	hits = 0;
+	misses = 0;
+	len = read(fd, buf, sizeof(buf) - 1);
+	if (len > 0) {
+		buf[len] = '\0';
+		sscanf(buf, "%li %li", &hits, &misses);
+	}
+
+	if (hit) hits++;
+	else misses++;
+
+	sprintf(buf, "%li %li\n", hits, misses);
+	lseek(fd, 0, SEEK_SET);
+	if (ftruncate(fd, 0) == 0 && write(fd, buf, strlen(buf)) < 0) {
+		/* statistics are best effort */
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	return;
+}
+
+void read_stats(long* hits, long* misses) {
+	FILE* fin;
+
+	*hits = 0;
+	*misses = 0;
+
+	fin = fopen((cache_dir + "/stats").c_str(), "r");
+	if (fin == NULL) return;
+	if (fscanf(fin, "%li %li", hits, misses) != 2) {
+		*hits = 0;
+		*misses = 0;
+	}
+	fclose(fin);
+
+	return;
+}
+
+void list_entries(std::vector<cache_entry_t>& entries) {
+	DIR* root;
+	DIR* sub;
+	struct dirent* dent;
+	struct dirent* fent;
+	struct stat st;
+	std::string dir;
+	cache_entry_t entry;
+
+	root = opendir(cache_dir.c_str());
+	if (root == NULL) return;
+
+	while ((dent = readdir(root)) != NULL) {
+		if (!is_shard(dent->d_name)) continue;
+
+		dir = cache_dir + "/" + dent->d_name;
+		if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+		sub = opendir(dir.c_str());
+		if (sub == NULL) continue;
+
+		while ((fent = readdir(sub)) != NULL) {
+			if (fent->d_name[0] == '.' || strchr(fent->d_name, '.')) continue;
+
+			entry.path = dir + "/" + fent->d_name;
+			if (lstat(entry.path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+				continue;
+			}
+			entry.mtime = st.st_mtime;
+			entry.size = st.st_size;
+			entries.push_back(entry);
+		}
+
+		closedir(sub);
+	}
+
+	closedir(root);
+
+	return;
+}
+
+/* Checks whether a name in the cache directory is that of a shard, which is
+ * the first byte of the keys in it as two lowercase hex digits. Anything
+ * else, such as . and .., is not the cache's to list or evict.
+ */
+int is_shard(const char* name) {
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!(name[i] >= '0' && name[i] <= '9')
+			&& !(name[i] >= 'a' && name[i] <= 'f')
+		) {
+			return 0;
+		}
+	}
+
+	return name[2] == '\0';
+}
+
+/* Remove the least recently used entries once the cache is over its size
+ * limit, bringing it back down to a low water mark so that eviction does not
+ * run on every store.
+ */
+void evict() {
+	long size;
+	std::vector<cache_entry_t> entries;
+	std::vector<cache_entry_t>::iterator entry;
+
+	if (cache_max <= 0) return;
+
+	list_entries(entries);
+
+	size = 0;
+	for (entry = entries.begin(); entry != entries.end(); entry++) {
+		size += entry->size;
+	}
+	if (size <= cache_max) return;
+
+	std::sort(entries.begin(), entries.end(), entry_older);
+
+	entry = entries.begin();
+	while (entry != entries.end() && size > cache_max * CACHE_LOW_WATER) {
+		if (unlink(entry->path.c_str()) == 0) size -= entry->size;
+		entry++;
+	}
+
+	return;
+}
+
+bool entry_older(const cache_entry_t& a, const cache_entry_t& b) {
+	return a.mtime < b.mtime;
+}
+
+/* Hand the captured output back to stdout if the compiler exits before the
+ * compile could be stored.
+ */
+void release() {
+	long len;
+	char buf[4096];
+
+	if (capture == NULL) return;
+
+	fflush(stdout);
+	dup2(saved_stdout, fileno(stdout));
+	close(saved_stdout);
+	saved_stdout = -1;
+
+	rewind(capture);
+	while ((len = fread(buf, 1, sizeof(buf), capture)) > 0) {
+		fwrite(buf, 1, len, stdout);
+	}
+	fclose(capture);
+	capture = NULL;
+	fflush(stdout);
+
+	return;
+}
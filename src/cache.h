@@ -0,0 +1,9 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+void cache_init(const char* dir, long max_bytes);
+int cache_fetch(char** files, int nfiles, const char* fout_name);
+void cache_store(const char* fout_name);
+void cache_print_stats();
+
+#endif /* _CACHE_H_ */
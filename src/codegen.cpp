@@ -1,4 +1,5 @@
 #include <map>
+#include <set>
 #include <stack>
 #include <stdlib.h>
 #include <stdio.h>
@@ -7,30 +8,104 @@
 #include "ast.h"
 #include "codegen.h"
 #include "emit.h"
+#include "flags.h"
+#include "ir.h"
+#include "ir_build.h"
+#include "ir_emit.h"
+#include "licm.h"
+#include "passes.h"
+#include "stats.h"
 #include "symtab.h"
+#include "trace.h"
 
 #define PARAM_STR_LEN 10
 #define NO_SIBLING false
+#define REG_CLOBBER 100
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+/* The highest data address of TM, which it leaves at address 0 for the
+ * program to find the globals with. A data image needs the globals at
+ * addresses known when compiling, so the program then sets GP itself.
+ */
+#define DATA_TOP 9999
+
+/* A conditional jump waiting for its target. An unconditional jump has no
+ * cmd.
+ */
+typedef struct {
+	int addr;
+	char* cmd;
+	int reg;
+} jump_t;
 
 extern int offset;
+extern flags_t flags;
 extern SymbolTable sem_symtab;
 
 static void global_init(std::string name, void* ptr);
+static void build_ir(ast_t* tree);
 static void traverse(ast_t* node, bool sibling = true);
 static int base_reg(ast_t* var);
+static void expr(ast_t* node, int reg);
+static void expr_operands(ast_t* node, int reg, int* lhs, int* rhs);
+static int expr_need(ast_t* node);
+static int expr_remat(ast_t* leaf, ast_t* other);
+static int expr_reduce(ast_t* node, int reg);
+static int direct_element(ast_t* lhs, int* disp);
+static void element_address(ast_t* subsc);
+static int rmw_assign(ast_t* node);
+static int is_leaf(ast_t* func);
+static int has_call(ast_t* node);
+static void emit_return();
+static int has_assign(ast_t* node);
+static void cond_jump(ast_t* node, int sense, std::vector<jump_t>* jumps);
+static void patch_jumps(std::vector<jump_t>* jumps, char* comment);
+static int fused_jump(ast_t* node, int sense, std::vector<jump_t>* jumps);
+static void inline_body(ast_t* call, int frame);
+static int tail_call(ast_t* call);
+static int uses_frame(ast_t* node);
 
 static int main_addr;
 static int tmp_offset;
 static std::map<std::string, int> func_addr;
 static std::stack<std::vector<int>* > break_addrs;
 static ast_t* curr_func;
+static int curr_leaf;
+static int max_reg;
+static std::set<std::string> leaf_funcs;
+static std::vector<int>* return_addrs;
+static std::map<ast_t*, int> hoisted;
+static std::map<ast_t*, ir_func_t*> irs;
+static int need_io;
+static int num_tail_calls;
+static int num_self_tail_calls;
+static int num_reductions;
+static int num_data;
 
 void codegen(ast_t* tree, FILE* fout) {
+	int count;
+	instr_t* code;
+
 	curr_func = NULL;
+	curr_leaf = 0;
+	max_reg = AC3;
+	leaf_funcs.clear();
+	return_addrs = NULL;
+	hoisted.clear();
+	num_tail_calls = 0;
+	num_self_tail_calls = 0;
+	num_reductions = 0;
+	num_data = 0;
 	main_addr = -1;
 	tmp_offset = 0;
+	irs.clear();
+	need_io = 1;
+
+	if (flags.ir) build_ir(tree);
 
 	emitSetFile(fout);
+	if (passes_enabled(PASS_INSTR)) emitStartBuffer();
 
 	emitComment("C- compiler version F16");
 	emitComment("Author: Mason Fabel");
@@ -42,7 +117,11 @@ void codegen(ast_t* tree, FILE* fout) {
 	backPatchAJumpToHere(0, "Jump to INIT [BACKPATCH]");
 
 	emitComment("INIT");
-	emitRM("LD", GP, 0, GP,  "Set GP");
+	if (flags.data_image) {
+		emitRM("LDC", GP, DATA_TOP, NONE,  "Set GP");
+	} else {
+		emitRM("LD", GP, 0, GP,  "Set GP");
+	}
 	emitRM("LDA", FP, offset, GP,  "Set first frame");
 	emitRM("ST", FP, 0, FP,  "Store old FP (point to self)");
 
@@ -50,14 +129,78 @@ void codegen(ast_t* tree, FILE* fout) {
 	sem_symtab.applyToAllGlobal(global_init);
 	emitComment("END INIT GLOBALS");
 
-	emitRM("LDA", AC, 1, PC, "Return address in AC");
-	if (main_addr > 0) emitRMAbs("LDA", PC, main_addr - 1, "Jump to main");
+	if (leaf_funcs.count("main")) {
+		emitRM("LDA", AC3, 1, PC, "Return address in AC3");
+	} else {
+		emitRM("LDA", AC, 1, PC, "Return address in AC");
+	}
+	if (main_addr > 0) emitRMAbs("LDA", PC, main_addr, "Jump to main");
 	emitRO("HALT", 0, 0, 0, "DONE!");
 	emitComment("END INIT");
 
+	stats_count("codegen", "self tail calls", num_self_tail_calls);
+	stats_count("codegen", "other tail calls", num_tail_calls);
+	stats_count("codegen", "strength reductions", num_reductions);
+	stats_count("codegen", "globals in data image", num_data);
+
+	if (passes_enabled(PASS_INSTR)) {
+		code = emitGetBuffer(&count);
+		passes_run_instr(code, count);
+		emitFlushBuffer();
+	}
+
 	return;
 }
 
+/* Lowers every function with a body into the IR before any code is
+ * generated. Calls to the IO library become IO instructions there, so the
+ * library itself is only generated when some function could not be
+ * lowered.
+ */
+void build_ir(ast_t* tree) {
+	int num_lowered;
+	ast_t* node;
+	ir_func_t* ir;
+
+	need_io = 0;
+	num_lowered = 0;
+
+	for (node = tree; node; node = node->sibling) {
+		if (node->type != NODE_FUNC || node->child[1] == NULL) continue;
+		if (node->data.is_unused) continue;
+
+		trace_begin("ir", node->data.name);
+		ir = ir_build(node);
+		if (trace_enabled()) {
+			trace_end("ir", node->data.name, 1, "blocks",
+				ir ? (int) ir->blocks.size() : 0);
+		}
+
+		if (ir == NULL) {
+			need_io = 1;
+			continue;
+		}
+
+		passes_run_ir(ir);
+
+		if (flags.emit_ir) ir_print(stdout, ir);
+		irs[node] = ir;
+		num_lowered++;
+	}
+
+	stats_count("ir", "functions lowered", num_lowered);
+
+	return;
+}
+
+int codegen_func_addr(const char* name) {
+	return func_addr[std::string(name)];
+}
+
+int codegen_is_leaf(const char* name) {
+	return leaf_funcs.count(name);
+}
+
 int base_reg(ast_t* var) {
 	int reg;
 
@@ -82,12 +225,24 @@ static void global_init(std::string name, void* ptr) {
 
 	if (node->type != NODE_VAR) return;
 	if (node->data.mem.scope != SCOPE_GLOBAL) return;
+	if (node->data.is_unused) return;
 
-	if (node->data.is_array) {
+	if (node->data.is_array && flags.data_image) {
+		emitData(DATA_TOP + node->data.mem.loc + 1, node->data.mem.size - 1,
+			"Size of array", node->data.name);
+		num_data++;
+	} else if (node->data.is_array) {
 		emitRM("LDC", AC, node->data.mem.size - 1, NONE,
 			"Load size of array", node->data.name);
 		emitRM("ST", AC, node->data.mem.loc + 1, GP,
 			"Save size of array", node->data.name);
+	} else if (node->child[0] && flags.data_image
+		&& node->child[0]->type == NODE_CONST
+	) {
+		emitData(DATA_TOP + node->data.mem.loc,
+			ast_const_value(node->child[0]), "Initial value",
+			node->data.name);
+		num_data++;
 	} else if (node->child[0]) {
 		traverse(node->child[0]);
 		emitRM("ST", AC, node->data.mem.loc, GP,
@@ -102,12 +257,24 @@ void traverse(ast_t* node, bool sibling) {
 
 	switch (node->type) {
 		case NODE_ASSIGN:
+			int disp;
+
 			emitComment("ASSIGN");
+			if (flags.rmw && rmw_assign(node)) {
+				emitComment("END ASSIGN");
+				break;
+			}
 
 			if (node->child[0]->type == NODE_ID) {
 				emitRM("LD", AC, node->child[0]->data.mem.loc,
 					base_reg(node->child[0]),
 					"Load variable", node->child[0]->data.name);
+			} else if (direct_element(node->child[0], &disp)) {
+				emitRM("LD", AC, disp, base_reg(node->child[0]->child[0]),
+					"OP [");
+			} else if (flags.addressing) {
+				element_address(node->child[0]);
+				emitRM("LD", AC, 0, AC1, "OP [");
 			} else if (node->child[0]->type == NODE_OP) {
 				traverse(node->child[0]->child[1]);
 				if (node->child[0]->child[0]->data.mem.scope == SCOPE_PARAM) {
@@ -128,7 +295,10 @@ void traverse(ast_t* node, bool sibling) {
 					emitRM("LD", AC, 0, AC1, "OP [");
 				}
 			}
-			emitRM("ST", AC1, tmp_offset--, FP, "Store address");
+			if (!direct_element(node->child[0], &disp)) {
+				emitRM("ST", AC1, tmp_offset, FP, "Store address");
+			}
+			tmp_offset--;
 			emitRM("ST", AC, tmp_offset--, FP, "Store value");
 
 			switch (node->data.op) {
@@ -173,6 +343,11 @@ void traverse(ast_t* node, bool sibling) {
 				emitRM("ST", AC, node->child[0]->data.mem.loc,
 					base_reg(node->child[0]),
 					"Store variable", node->child[0]->data.name);
+			} else if (direct_element(node->child[0], &disp)) {
+				++tmp_offset; // pop address
+				emitRM("ST", AC, disp, base_reg(node->child[0]->child[0]),
+					"Store element in array",
+					node->child[0]->child[0]->data.name);
 			} else if (node->child[0]->type == NODE_OP) {
 				emitRM("ST", AC, tmp_offset--, FP, "Store RHS");
 				emitRM("LD", AC, ++tmp_offset, FP, "Load RHS");
@@ -195,7 +370,10 @@ void traverse(ast_t* node, bool sibling) {
 			ast_t* param;
 
 			emitComment("CALL", node->data.name);
-			emitRM("ST", FP, tmp_offset, FP, "Store old FP in ghost frame");
+			if (!node->data.is_inline && !leaf_funcs.count(node->data.name)) {
+				emitRM("ST", FP, tmp_offset, FP,
+					"Store old FP in ghost frame");
+			}
 
 			tmp_offset -= 2;
 
@@ -212,11 +390,25 @@ void traverse(ast_t* node, bool sibling) {
 			tmp_offset += i;
 			tmp_offset += 2;
 
+			if (node->data.is_inline) {
+				inline_body(node, tmp_offset);
+				emitComment("END CALL", node->data.name);
+				break;
+			}
+
 			emitComment("JUMP TO", node->data.name);
 			emitRM("LDA", FP, tmp_offset, FP, "Load addr of new frame");
-			emitRM("LDA", AC, 1, PC, "Return addr in AC");
-			emitRMAbs("LDA", PC, func_addr[node->data.name],
-				"CALL", node->data.name);
+			if (leaf_funcs.count(node->data.name)) {
+				/* a leaf leaves FP to be restored by its caller */
+				emitRM("LDA", AC3, 1, PC, "Return addr in AC3");
+				emitRMAbs("LDA", PC, func_addr[node->data.name],
+					"CALL", node->data.name);
+				emitRM("LDA", FP, -tmp_offset, FP, "Restore FP");
+			} else {
+				emitRM("LDA", AC, 1, PC, "Return addr in AC");
+				emitRMAbs("LDA", PC, func_addr[node->data.name],
+					"CALL", node->data.name);
+			}
 			emitRM("LDA", AC, 0, RT, "Save result in AC");
 			emitComment("END CALL", node->data.name);
 
@@ -267,20 +459,31 @@ void traverse(ast_t* node, bool sibling) {
 			int jump_addr;
 			int then_addr;
 			int else_addr;
+			std::vector<jump_t>* jumps;
 
 			has_else = node->child[2] ? 1 : 0;
 
 			emitComment("IF");
-			traverse(node->child[0]);
+			if (flags.short_circuit) {
+				jumps = new std::vector<jump_t>();
+				cond_jump(node->child[0], 0, jumps);
+			} else {
+				traverse(node->child[0]);
+			}
 
 			emitComment("THEN");
-			then_addr = emitSkip(1);
+			if (!flags.short_circuit) then_addr = emitSkip(1);
 			traverse(node->child[1]);
 
 			if (has_else) jump_addr = emitSkip(1);
 
-			backPatchAJumpToHere("JZR", AC, then_addr,
-				"Jump past THEN if false [BACKPATCH]");
+			if (flags.short_circuit) {
+				patch_jumps(jumps, "Jump past THEN if false [BACKPATCH]");
+				delete jumps;
+			} else {
+				backPatchAJumpToHere("JZR", AC, then_addr,
+					"Jump past THEN if false [BACKPATCH]");
+			}
 
 
 			if (has_else) {
@@ -297,85 +500,103 @@ void traverse(ast_t* node, bool sibling) {
 			break;
 
 		case NODE_FUNC:
+			ir_func_t* ir;
+
+			if (node->data.is_unused) break;
+			if (node->child[1] == NULL && !need_io) break;
+			trace_begin("codegen", node->data.name);
 			func_addr[std::string(node->data.name)] = emitSkip(0);
+			ir = irs.count(node) ? irs[node] : NULL;
+			if (ir ? flags.leaf && !ir_has_call(ir) : is_leaf(node)) {
+				leaf_funcs.insert(node->data.name);
+			}
+			curr_leaf = leaf_funcs.count(node->data.name);
+			max_reg = curr_leaf ? AC2 : AC3;
 
 			emitComment("FUNCTION", node->data.name);
-			emitRM("ST", AC, -1, FP, "Store return address");
+			if (!curr_leaf && !ir) {
+				emitRM("ST", AC, -1, FP, "Store return address");
+			}
 
-			if (!strcmp("input", node->data.name)) {
+			if (ir) {
+				if (!strcmp("main", node->data.name)) {
+					main_addr = func_addr[std::string(node->data.name)];
+				}
+				ir_emit(ir, curr_leaf);
+				ir_free(ir);
+			} else if (!strcmp("input", node->data.name)) {
 				emitRO("IN", RT, NONE, NONE, "Grab int input");
-				emitRM("LD", AC, -1, FP, "Load return address");
-				emitRM("LD", FP, 0, FP, "Adjust FP");
-				emitRM("LDA", PC, 0, AC, "Return");
+				emit_return();
 			} else if (!strcmp("inputb", node->data.name)) {
 				emitRO("INB", RT, NONE, NONE, "Grab bool input");
-				emitRM("LD", AC, -1, FP, "Load return address");
-				emitRM("LD", FP, 0, FP, "Adjust FP");
-				emitRM("LDA", PC, 0, AC, "Return");
+				emit_return();
 			} else if (!strcmp("inputc", node->data.name)) {
 				emitRO("INC", RT, NONE, NONE, "Grab char input");
-				emitRM("LD", AC, -1, FP, "Load return address");
-				emitRM("LD", FP, 0, FP, "Adjust FP");
-				emitRM("LDA", PC, 0, AC, "Return");
+				emit_return();
 			} else if (!strcmp("output", node->data.name)) {
 				emitRM("LD", AC, (node->child[0])->data.mem.loc, FP,
 					"Load parameter");
 				emitRO("OUT", AC, NONE, NONE, "Output int");
 				emitRM("LDC", RT, 0, NONE, "Set return value to 0");
-				emitRM("LD", AC, -1, FP, "Load return address");
-				emitRM("LD", FP, 0, FP, "Adjust FP");
-				emitRM("LDA", PC, 0, AC, "Return");
+				emit_return();
 			} else if (!strcmp("outputb", node->data.name)) {
 				emitRM("LD", AC, (node->child[0])->data.mem.loc, FP,
 					"Load parameter");
 				emitRO("OUTB", AC, NONE, NONE, "Output bool");
 				emitRM("LDC", RT, 0, NONE, "Set return value to 0");
-				emitRM("LD", AC, -1, FP, "Load return address");
-				emitRM("LD", FP, 0, FP, "Adjust FP");
-				emitRM("LDA", PC, 0, AC, "Return");
+				emit_return();
 			} else if (!strcmp("outputc", node->data.name)) {
 				emitRM("LD", AC, (node->child[0])->data.mem.loc, FP,
 					"Load parameter");
 				emitRO("OUTC", AC, NONE, NONE, "Output char");
 				emitRM("LDC", RT, 0, NONE, "Set return value to 0");
-				emitRM("LD", AC, -1, FP, "Load return address");
-				emitRM("LD", FP, 0, FP, "Adjust FP");
-				emitRM("LDA", PC, 0, AC, "Return");
+				emit_return();
 			} else if (!strcmp("outnl", node->data.name)) {
 				emitRO("OUTNL", NONE, NONE, NONE, "Output newline");
-				emitRM("LD", AC, -1, FP, "Load return address");
-				emitRM("LD", FP, 0, FP, "Adjust FP");
-				emitRM("LDA", PC, 0, AC, "Return");
+				emit_return();
 			} else if (!strcmp("main", node->data.name)) {
 				curr_func = node;
 				tmp_offset = node->data.mem.size;
-				main_addr = emitSkip(0);
+				main_addr = func_addr[std::string(node->data.name)];
 				traverse(node->child[1]);
 				emitComment("FUNCTION CLOSE", node->data.name);
-				emitRM("LDC", RT, 0, NONE, "Set return value to 0");
-				emitRM("LD", AC, -1, FP, "Load return address");
-				emitRM("LD", FP, 0, FP, "Adjust FP");
-				emitRM("LDA", PC, 0, AC, "Return");
+				if (!flags.leaf || ast_can_complete(node->child[1])) {
+					emitRM("LDC", RT, 0, NONE, "Set return value to 0");
+					emit_return();
+				}
 			} else {
 				curr_func = node;
 				tmp_offset = node->data.mem.size;
 				traverse(node->child[1]);
 				emitComment("FUNCTION CLOSE", node->data.name);
-				emitRM("LDC", RT, 0, NONE, "Set return value to 0");
-				emitRM("LD", AC, -1, FP, "Load return address");
-				emitRM("LD", FP, 0, FP, "Adjust FP");
-				emitRM("LDA", PC, 0, AC, "Return");
+				if (!flags.leaf || ast_can_complete(node->child[1])) {
+					emitRM("LDC", RT, 0, NONE, "Set return value to 0");
+					emit_return();
+				}
 			}
 
 
 			emitComment("END FUNCTION", node->data.name);
 
+			if (trace_enabled()) {
+				trace_end("codegen", node->data.name, 2, "instructions",
+					emitSkip(0) - func_addr[std::string(node->data.name)],
+					"ast_nodes", ast_size(node));
+			}
+
 			curr_func = NULL;
+			curr_leaf = 0;
+			max_reg = AC3;
 			tmp_offset = 0;
 
 			break;
 
 		case NODE_OP:
+			if (flags.regalloc) {
+				expr(node, AC);
+				break;
+			}
+
 			switch (node->data.op) {
 				case OP_ADD:
 					traverse(node->child[0]);
@@ -387,6 +608,10 @@ void traverse(ast_t* node, bool sibling) {
 					emitRO("ADD", AC, AC, AC1, "OP +");
 					break;
 				case OP_AND:
+					if (flags.short_circuit) {
+						expr(node, AC);
+						break;
+					}
 					traverse(node->child[0]);
 					emitRM("ST", AC, tmp_offset--, FP, "Store LHS");
 					traverse(node->child[1]);
@@ -499,6 +724,10 @@ void traverse(ast_t* node, bool sibling) {
 					emitRO("RND", AC, AC, NONE, "UNARY OP ?");
 					break;
 				case OP_OR:
+					if (flags.short_circuit) {
+						expr(node, AC);
+						break;
+					}
 					traverse(node->child[0]);
 					emitRM("ST", AC, tmp_offset--, FP, "Store LHS");
 					traverse(node->child[1]);
@@ -555,13 +784,20 @@ void traverse(ast_t* node, bool sibling) {
 
 		case NODE_RETURN:
 			emitComment("RETURN");
+			if (node->child[0] && node->child[0]->type == NODE_CALL
+				&& tail_call(node->child[0])
+			) {
+				break;
+			}
 			if (node->child[0]) {
 				traverse(node->child[0]);
 				emitRM("LDA", RT, 0, AC, "Copy result to RT");
 			}
-			emitRM("LD", AC, -1, FP, "Load return address");
-			emitRM("LD", FP, 0, FP, "Adjust FP");
-			emitRM("LDA", PC, 0, AC, "Return");
+			if (return_addrs) {
+				return_addrs->push_back(emitSkip(1));
+				break;
+			}
+			emit_return();
 			break;
 
 		case NODE_VAR:
@@ -582,21 +818,47 @@ void traverse(ast_t* node, bool sibling) {
 		case NODE_WHILE:
 			int end_addr;
 			int loop_addr;
+			int saved_offset;
 			std::vector<int>::iterator break_addr;
+			std::vector<ast_t*> invariants;
+			std::vector<ast_t*>::iterator invariant;
 
 			break_addrs.push(new std::vector<int>());
 
+			/* the preheader keeps invariants in temporaries */
+			saved_offset = tmp_offset;
+			if (flags.licm && flags.regalloc) {
+				licm_invariants(node, &invariants);
+			}
+			if (!invariants.empty()) emitComment("PREHEADER");
+			for (invariant = invariants.begin();
+				invariant != invariants.end(); invariant++
+			) {
+				expr(*invariant, AC);
+				emitRM("ST", AC, tmp_offset, FP, "Store invariant");
+				hoisted[*invariant] = tmp_offset--;
+			}
+
 			emitComment("WHILE");
 			loop_addr = emitSkip(0);
-			traverse(node->child[0]);
-			emitRM("JNZ", AC, 1, PC, "Jump to DO");
-
-			end_addr = emitSkip(1);
+			if (flags.short_circuit) {
+				jumps = new std::vector<jump_t>();
+				cond_jump(node->child[0], 0, jumps);
+			} else {
+				traverse(node->child[0]);
+				emitRM("JNZ", AC, 1, PC, "Jump to DO");
+				end_addr = emitSkip(1);
+			}
 
 			emitComment("DO");
 			traverse(node->child[1]);
 			emitRMAbs("LDA", PC, loop_addr, "Go to WHILE");
-			backPatchAJumpToHere(end_addr, "Jump past WHILE [BACKPATCH]");
+			if (flags.short_circuit) {
+				patch_jumps(jumps, "Jump past WHILE [BACKPATCH]");
+				delete jumps;
+			} else {
+				backPatchAJumpToHere(end_addr, "Jump past WHILE [BACKPATCH]");
+			}
 
 			break_addr = break_addrs.top()->begin();
 			while (break_addr != break_addrs.top()->end()) {
@@ -608,6 +870,12 @@ void traverse(ast_t* node, bool sibling) {
 			emitComment("END WHILE");
 
 			break_addrs.pop();
+			for (invariant = invariants.begin();
+				invariant != invariants.end(); invariant++
+			) {
+				hoisted.erase(*invariant);
+			}
+			tmp_offset = saved_offset;
 
 			break;
 	}
@@ -616,3 +884,889 @@ void traverse(ast_t* node, bool sibling) {
 
 	return;
 }
+
+/* Evaluates an expression into reg. The registers from reg up to max_reg
+ * are free and the ones below reg hold live values. The operands of a binary
+ * operator are ordered by their Sethi-Ullman numbers, so that the operand
+ * needing more registers goes first and the other one fits in what is left.
+ *
+ * Calls and assignments go through traverse(), which leaves the result in
+ * AC and clobbers every register. Their need is REG_CLOBBER, which is more
+ * than any register count, so they are only evaluated from AC with nothing
+ * live and everything else is spilled to the temporary stack around them.
+ */
+void expr(ast_t* node, int reg) {
+	int lhs;
+	int rhs;
+	int addr;
+	int value;
+	ast_t* var;
+
+	if (hoisted.count(node)) {
+		emitRM("LD", reg, hoisted[node], FP, "Load invariant");
+		return;
+	}
+
+	switch (node->type) {
+		case NODE_CONST:
+			switch (node->data.type) {
+				case TYPE_BOOL:
+					emitRM("LDC", reg, node->data.bool_val, NONE,
+						"Load boolean constant");
+					break;
+				case TYPE_CHAR:
+					emitRM("LDC", reg, node->data.char_val, NONE,
+						"Load character constant");
+					break;
+				case TYPE_INT:
+					emitRM("LDC", reg, node->data.int_val, NONE,
+						"Load integer constant");
+					break;
+			}
+			break;
+
+		case NODE_ID:
+			if (node->data.is_array && node->data.mem.scope != SCOPE_PARAM) {
+				emitRM("LDA", reg, node->data.mem.loc, base_reg(node),
+					"Load address of array", node->data.name);
+			} else if (node->data.is_array) {
+				emitRM("LD", reg, node->data.mem.loc, base_reg(node),
+					"Load address of array", node->data.name);
+			} else {
+				emitRM("LD", reg, node->data.mem.loc, base_reg(node),
+					"Load variable", node->data.name);
+			}
+			break;
+
+		case NODE_OP:
+			var = node->child[0];
+			if (flags.strength && expr_reduce(node, reg)) break;
+
+			switch (node->data.op) {
+				case OP_NEG:
+					expr(node->child[0], reg);
+					emitRM("LDC", reg + 1, -1, NONE, "Load integer constant");
+					emitRO("MUL", reg, reg, reg + 1, "UNARY OP -");
+					break;
+				case OP_NOT:
+					expr(node->child[0], reg);
+					emitRM("LDC", reg + 1, 0, NONE, "Load integer constant");
+					emitRO("TEQ", reg, reg, reg + 1, "UNARY OP not");
+					break;
+				case OP_QMARK:
+					expr(node->child[0], reg);
+					emitRO("RND", reg, reg, NONE, "UNARY OP ?");
+					break;
+				case OP_SIZE:
+					if (var->data.mem.scope == SCOPE_PARAM) {
+						emitRM("LD", reg, var->data.mem.loc, FP,
+							"Load address of array", var->data.name);
+						emitRM("LDC", reg + 1, 1, NONE,
+							"Load integer constant");
+						emitRO("ADD", reg, reg, reg + 1,
+							"Find address of size");
+						emitRM("LD", reg, 0, reg, "UNARY OP *");
+					} else {
+						emitRM("LD", reg, var->data.mem.loc + 1,
+							base_reg(var), "UNARY OP *");
+					}
+					break;
+				case OP_SUBSC:
+					if (flags.addressing
+						&& node->child[1]->type == NODE_CONST
+					) {
+						/* the element is at a fixed offset from the base */
+						value = ast_const_value(node->child[1]);
+						if (var->data.mem.scope == SCOPE_PARAM) {
+							emitRM("LD", reg, var->data.mem.loc, FP,
+								"Load address of array", var->data.name);
+							emitRM("LD", reg, -value, reg, "OP [");
+						} else {
+							emitRM("LD", reg, var->data.mem.loc - value,
+								base_reg(var), "OP [");
+						}
+						break;
+					}
+					expr(node->child[1], reg);
+					if (flags.addressing
+						&& var->data.mem.scope != SCOPE_PARAM
+					) {
+						emitRM("LDA", reg + 1, var->data.mem.loc,
+							base_reg(var), "Load address of array",
+							var->data.name);
+						emitRO("SUB", reg + 1, reg + 1, reg,
+							"Find address of element");
+						emitRM("LD", reg, 0, reg + 1, "OP [");
+						break;
+					}
+					if (var->data.mem.scope == SCOPE_PARAM) {
+						emitRM("LD", reg + 1, var->data.mem.loc, FP,
+							"Load address of array", var->data.name);
+						emitRO("SUB", reg + 1, reg + 1, reg,
+							"Find address of element");
+						emitRM("LD", reg, 0, reg + 1, "OP [");
+					} else {
+						emitRM("LDC", reg + 1, var->data.mem.loc, NONE,
+							"Load offset of array", var->data.name);
+						emitRO("SUB", reg + 1, reg + 1, reg,
+							"Find offset of element");
+						emitRM("LDA", reg, 0, base_reg(var),
+							"Find base address of array", var->data.name);
+						emitRO("ADD", reg + 1, reg + 1, reg,
+							"Find address of element");
+						emitRM("LD", reg, 0, reg + 1, "OP [");
+					}
+					break;
+				case OP_ADD:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("ADD", reg, lhs, rhs, "OP +");
+					break;
+				case OP_AND:
+					if (flags.short_circuit) {
+						/* a false LHS is already the result */
+						expr(node->child[0], reg);
+						addr = emitSkip(1);
+						expr(node->child[1], reg);
+						backPatchAJumpToHere("JZR", reg, addr,
+							"Skip RHS of and if false [BACKPATCH]");
+						break;
+					}
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("AND", reg, lhs, rhs, "OP and");
+					break;
+				case OP_DIV:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("DIV", reg, lhs, rhs, "OP /");
+					break;
+				case OP_EQ:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("TEQ", reg, lhs, rhs, "OP ==");
+					break;
+				case OP_GRT:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("TGT", reg, lhs, rhs, "OP >");
+					break;
+				case OP_GRTEQ:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("TGE", reg, lhs, rhs, "OP >=");
+					break;
+				case OP_LESS:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("TLT", reg, lhs, rhs, "OP <");
+					break;
+				case OP_LESSEQ:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("TLE", reg, lhs, rhs, "OP <=");
+					break;
+				case OP_MOD:
+					/* the need of at least 3 leaves reg + 2 free */
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("DIV", reg + 2, lhs, rhs, "OP %");
+					emitRO("MUL", reg + 2, reg + 2, rhs, "OP %");
+					emitRO("SUB", reg, lhs, reg + 2, "OP%");
+					break;
+				case OP_MUL:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("MUL", reg, lhs, rhs, "OP *");
+					break;
+				case OP_NOTEQ:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("TNE", reg, lhs, rhs, "OP !=");
+					break;
+				case OP_OR:
+					if (flags.short_circuit) {
+						/* a true LHS is already the result */
+						expr(node->child[0], reg);
+						addr = emitSkip(1);
+						expr(node->child[1], reg);
+						backPatchAJumpToHere("JNZ", reg, addr,
+							"Skip RHS of or if true [BACKPATCH]");
+						break;
+					}
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("OR", reg, lhs, rhs, "OP or");
+					break;
+				case OP_SUB:
+					expr_operands(node, reg, &lhs, &rhs);
+					emitRO("SUB", reg, lhs, rhs, "OP -");
+					break;
+			}
+			break;
+
+		default:
+			traverse(node, NO_SIBLING);
+			if (reg != AC) emitRM("LDA", reg, 0, AC, "Move result");
+			break;
+	}
+
+	return;
+}
+
+/* Generates cheaper code for an operator with a constant operand. Negation
+ * uses NEG rather than a multiply by -1, a multiply by 2 is an add, a divide
+ * by 1 or -1 is the dividend or its negation and x % 1 is 0. TM has no
+ * shifts, so a modulo by a power of two becomes a mask only when the
+ * dividend cannot be negative. Returns 0 if nothing applies.
+ */
+int expr_reduce(ast_t* node, int reg) {
+	int c;
+	ast_t* other;
+
+	if (node->data.op == OP_NEG) {
+		expr(node->child[0], reg);
+		emitRO("NEG", reg, reg, NONE, "UNARY OP -");
+		num_reductions++;
+		return 1;
+	}
+
+	if (node->num_children < 2) return 0;
+	if (node->child[1]->type == NODE_CONST) {
+		c = ast_const_value(node->child[1]);
+		other = node->child[0];
+	} else if (node->data.op == OP_MUL
+		&& node->child[0]->type == NODE_CONST
+	) {
+		c = ast_const_value(node->child[0]);
+		other = node->child[1];
+	} else {
+		return 0;
+	}
+
+	switch (node->data.op) {
+		case OP_MUL:
+			if (c == 2) {
+				expr(other, reg);
+				emitRO("ADD", reg, reg, reg, "OP * 2");
+				break;
+			}
+			if (c == -1) {
+				expr(other, reg);
+				emitRO("NEG", reg, reg, NONE, "OP * -1");
+				break;
+			}
+			return 0;
+		case OP_DIV:
+			if (c == 1) {
+				expr(other, reg);
+				break;
+			}
+			if (c == -1) {
+				expr(other, reg);
+				emitRO("NEG", reg, reg, NONE, "OP / -1");
+				break;
+			}
+			return 0;
+		case OP_MOD:
+			if (c == 1 || c == -1) {
+				if (!ast_is_pure(other)) expr(other, reg);
+				emitRM("LDC", reg, 0, NONE, "OP % 1");
+				break;
+			}
+			if (c > 0 && (c & (c - 1)) == 0 && ast_non_negative(other)) {
+				/* the need of at least 3 leaves reg + 1 free */
+				expr(other, reg);
+				emitRM("LDC", reg + 1, c - 1, NONE, "Load mask");
+				emitRO("AND", reg, reg, reg + 1, "OP % power of 2");
+				break;
+			}
+			return 0;
+		default:
+			return 0;
+	}
+
+	num_reductions++;
+
+	return 1;
+}
+
+/* Checks whether the target of an assignment is an array element at a
+ * fixed offset from GP or FP, and finds that offset.
+ */
+int direct_element(ast_t* lhs, int* disp) {
+	ast_t* var;
+
+	if (!flags.addressing || lhs->type != NODE_OP) return 0;
+
+	var = lhs->child[0];
+	if (var->data.mem.scope == SCOPE_PARAM) return 0;
+	if (lhs->child[1]->type != NODE_CONST) return 0;
+
+	*disp = var->data.mem.loc - ast_const_value(lhs->child[1]);
+
+	return 1;
+}
+
+/* Generates an assignment without the temporary stack. The address of the
+ * target is found once, and the value stays in a register. The general
+ * code loads the old value before it evaluates the right hand side, so a
+ * right hand side with side effects is left to it, as is one that needs
+ * the registers holding an element address. Returns 0 in those cases.
+ */
+int rmw_assign(ast_t* node) {
+	int i;
+	int disp;
+	int base;
+	int value;
+	ast_t* target;
+	ast_t* rhs;
+	static const struct {
+		ast_op_t op;
+		const char* cmd;
+		const char* comment;
+	} ops[] = {
+		{OP_ADDASS, "ADD", "ADD for OP +="},
+		{OP_DEC, "SUB", "SUB for OP --"},
+		{OP_DIVASS, "DIV", "DIV for OP /="},
+		{OP_INC, "ADD", "ADD for OP ++"},
+		{OP_MULASS, "MUL", "MUL for OP *="},
+		{OP_SUBASS, "SUB", "SUB for OP -="},
+		{OP_ASS, NULL, NULL},
+	};
+
+	target = node->child[0];
+	rhs = node->child[1];
+	for (i = 0; ops[i].op != OP_ASS && ops[i].op != node->data.op; i++);
+
+	/* the target is either at a fixed offset or at an address in AC1 */
+	if (target->type == NODE_ID) {
+		disp = target->data.mem.loc;
+		base = base_reg(target);
+	} else if (direct_element(target, &disp)) {
+		base = base_reg(target->child[0]);
+	} else {
+		if (rhs && (!flags.regalloc || !ast_is_pure(rhs)
+			|| expr_need(rhs) > max_reg - AC2 + 1)
+		) {
+			return 0;
+		}
+		element_address(target);
+		disp = 0;
+		base = AC1;
+	}
+
+	if (ops[i].cmd == NULL) {
+		/* a plain assignment never reads the old value */
+		if (base == AC1) {
+			expr(rhs, AC2);
+			emitRM("ST", AC2, 0, AC1, "Store element in array",
+				target->child[0]->data.name);
+			emitRM("LDA", AC, 0, AC2, "Move result");
+			return 1;
+		}
+		traverse(rhs);
+	} else if (rhs == NULL || (rhs->type == NODE_CONST
+		&& (node->data.op == OP_ADDASS || node->data.op == OP_SUBASS))
+	) {
+		value = rhs ? ast_const_value(rhs) : 1;
+		if (!strcmp(ops[i].cmd, "SUB")) value = -value;
+		emitRM("LD", AC, disp, base, "Load value");
+		emitRM("LDA", AC, value, AC, (char*) ops[i].comment);
+	} else if (!ast_is_pure(rhs)) {
+		return 0;
+	} else if (base == AC1) {
+		expr(rhs, AC2);
+		emitRM("LD", AC, 0, AC1, "Load value");
+		emitRO((char*) ops[i].cmd, AC, AC, AC2, (char*) ops[i].comment);
+	} else {
+		traverse(rhs);
+		emitRM("LD", AC1, disp, base, "Load value");
+		emitRO((char*) ops[i].cmd, AC, AC1, AC, (char*) ops[i].comment);
+	}
+
+	if (target->type == NODE_ID) {
+		emitRM("ST", AC, disp, base, "Store variable", target->data.name);
+	} else {
+		emitRM("ST", AC, disp, base, "Store element in array",
+			target->child[0]->data.name);
+	}
+
+	return 1;
+}
+
+/* Leaves the address of an array element in AC1, with a single SUB of the
+ * index from the address of the array.
+ */
+void element_address(ast_t* subsc) {
+	ast_t* var;
+
+	var = subsc->child[0];
+
+	/* a constant index is folded into the displacement, while an array
+	 * parameter has to load its address first
+	 */
+	if (subsc->child[1]->type == NODE_CONST) {
+		if (var->data.mem.scope == SCOPE_PARAM) {
+			emitRM("LD", AC1, var->data.mem.loc, FP,
+				"Load address of array", var->data.name);
+			emitRM("LDA", AC1, -ast_const_value(subsc->child[1]), AC1,
+				"Find address of element");
+		} else {
+			emitRM("LDA", AC1,
+				var->data.mem.loc - ast_const_value(subsc->child[1]),
+				base_reg(var), "Find address of element", var->data.name);
+		}
+		return;
+	}
+
+	traverse(subsc->child[1]);
+	if (var->data.mem.scope == SCOPE_PARAM) {
+		emitRM("LD", AC1, var->data.mem.loc, FP,
+			"Load address of array", var->data.name);
+	} else {
+		emitRM("LDA", AC1, var->data.mem.loc, base_reg(var),
+			"Load address of array", var->data.name);
+	}
+	emitRO("SUB", AC1, AC1, AC, "Find address of element");
+
+	return;
+}
+
+/* Evaluates both operands of a binary operator into registers, leaving reg
+ * free for the result. Operands with side effects are always evaluated left
+ * to right. When neither operand fits in the registers left over by the
+ * other, the left one is spilled, unless it can simply be loaded again.
+ */
+void expr_operands(ast_t* node, int reg, int* lhs, int* rhs) {
+	int free;
+	int need_lhs;
+	int need_rhs;
+	int in_order;
+
+	free = max_reg - reg + 1;
+	need_lhs = expr_need(node->child[0]);
+	need_rhs = expr_need(node->child[1]);
+	in_order = !ast_is_pure(node->child[0]) || !ast_is_pure(node->child[1]);
+
+	if (need_rhs < free && (need_lhs >= need_rhs || in_order)) {
+		expr(node->child[0], reg);
+		expr(node->child[1], reg + 1);
+		*lhs = reg;
+		*rhs = reg + 1;
+	} else if (need_lhs < free
+		&& (!in_order || expr_remat(node->child[0], node->child[1]))
+	) {
+		expr(node->child[1], reg);
+		expr(node->child[0], reg + 1);
+		*lhs = reg + 1;
+		*rhs = reg;
+	} else {
+		expr(node->child[0], reg);
+		emitRM("ST", reg, tmp_offset--, FP, "Store LHS");
+		expr(node->child[1], reg);
+		emitRM("LD", reg + 1, ++tmp_offset, FP, "Load LHS");
+		*lhs = reg + 1;
+		*rhs = reg;
+	}
+
+	return;
+}
+
+/* Returns the Sethi-Ullman number of an expression, the number of registers
+ * needed to evaluate it without spilling.
+ */
+int expr_need(ast_t* node) {
+	int lhs;
+	int rhs;
+	int need;
+
+	if (hoisted.count(node)) return 1;
+
+	switch (node->type) {
+		case NODE_CONST:
+		case NODE_ID:
+			return 1;
+		case NODE_OP:
+			break;
+		default:
+			return REG_CLOBBER;
+	}
+
+	switch (node->data.op) {
+		case OP_NEG:
+		case OP_NOT:
+			return MAX(expr_need(node->child[0]), 2);
+		case OP_QMARK:
+			return expr_need(node->child[0]);
+		case OP_SIZE:
+			return node->child[0]->data.mem.scope == SCOPE_PARAM ? 2 : 1;
+		case OP_SUBSC:
+			if (flags.addressing && node->child[1]->type == NODE_CONST) {
+				return 1;
+			}
+			return MAX(expr_need(node->child[1]), 2);
+	}
+
+	lhs = expr_need(node->child[0]);
+	rhs = expr_need(node->child[1]);
+
+	/* short circuit operands are evaluated one after the other */
+	if (flags.short_circuit
+		&& (node->data.op == OP_AND || node->data.op == OP_OR)
+	) {
+		return MAX(lhs, rhs);
+	}
+
+	need = lhs == rhs ? lhs + 1 : MAX(lhs, rhs);
+	if (node->data.op == OP_MOD) need = MAX(need, 3);
+
+	return need;
+}
+
+/* Checks whether a leaf operand can be loaded after the other operand has
+ * been evaluated instead of being spilled. Constants and array addresses
+ * never change, and a call cannot reach the scalar locals of its caller.
+ */
+int expr_remat(ast_t* leaf, ast_t* other) {
+	switch (leaf->type) {
+		case NODE_CONST:
+			return 1;
+		case NODE_ID:
+			if (leaf->data.is_array) {
+				return leaf->data.mem.scope != SCOPE_PARAM;
+			}
+			if (leaf->data.mem.scope == SCOPE_LOCAL
+				|| leaf->data.mem.scope == SCOPE_PARAM
+			) {
+				return !has_assign(other);
+			}
+			break;
+	}
+
+	return 0;
+}
+
+int has_assign(ast_t* node) {
+	int i;
+	ast_t* child;
+
+	if (node->type == NODE_ASSIGN) return 1;
+
+	for (i = 0; i < node->num_children; i++) {
+		for (child = node->child[i]; child; child = child->sibling) {
+			if (has_assign(child)) return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Emits a test of a condition that jumps when its value equals sense and
+ * falls through otherwise. The jumps are added to jumps to be patched once
+ * the target is known. Conditions made of and, or and not become a chain of
+ * jumps, so the right operand is skipped whenever the left one decides the
+ * outcome.
+ */
+void cond_jump(ast_t* node, int sense, std::vector<jump_t>* jumps) {
+	jump_t jump;
+	std::vector<jump_t>* skip;
+
+	if (node->type == NODE_OP && !hoisted.count(node)) {
+		switch (node->data.op) {
+			case OP_AND:
+			case OP_OR:
+				/* for and, a false LHS means false, and for or, a true LHS
+				 * means true. Otherwise the RHS is the value.
+				 */
+				if ((node->data.op == OP_OR) == sense) {
+					cond_jump(node->child[0], sense, jumps);
+					cond_jump(node->child[1], sense, jumps);
+				} else {
+					skip = new std::vector<jump_t>();
+					cond_jump(node->child[0], !sense, skip);
+					cond_jump(node->child[1], sense, jumps);
+					patch_jumps(skip, "Skip RHS [BACKPATCH]");
+					delete skip;
+				}
+				return;
+			case OP_NOT:
+				cond_jump(node->child[0], !sense, jumps);
+				return;
+		}
+	}
+
+	if (node->type == NODE_CONST) {
+		if (node->data.bool_val != sense) return;
+		jump.cmd = NULL;
+	} else if (flags.fused_branch && !hoisted.count(node)
+		&& fused_jump(node, sense, jumps)
+	) {
+		return;
+	} else {
+		traverse(node, NO_SIBLING);
+		jump.cmd = (char*) (sense ? "JNZ" : "JZR");
+	}
+
+	jump.addr = emitSkip(1);
+	jump.reg = AC;
+	jumps->push_back(jump);
+
+	return;
+}
+
+void patch_jumps(std::vector<jump_t>* jumps, char* comment) {
+	std::vector<jump_t>::iterator jump;
+
+	for (jump = jumps->begin(); jump != jumps->end(); jump++) {
+		if (jump->cmd) {
+			backPatchAJumpToHere(jump->cmd, jump->reg, jump->addr, comment);
+		} else {
+			backPatchAJumpToHere(jump->addr, comment);
+		}
+	}
+
+	return;
+}
+
+/* Compiles a comparison in a test into a conditional jump on lhs - rhs,
+ * instead of computing a boolean and testing that. A constant operand is
+ * subtracted with LDA, and a comparison with 0 tests the other operand
+ * directly. The difference may wrap around, which still leaves it 0 only
+ * for equal operands, but can flip its sign, so an ordered comparison is
+ * only fused when it is with 0. Returns 0 for a comparison left to the
+ * exact test instructions.
+ */
+int fused_jump(ast_t* node, int sense, std::vector<jump_t>* jumps) {
+	int i;
+	int lhs;
+	int rhs;
+	int value;
+	ast_op_t op;
+	jump_t jump;
+	static const struct {
+		ast_op_t op;
+		ast_op_t swapped;
+		const char* jump_true;
+		const char* jump_false;
+	} tests[] = {
+		{ OP_EQ, OP_EQ, "JEQ", "JNE" },
+		{ OP_NOTEQ, OP_NOTEQ, "JNE", "JEQ" },
+		{ OP_LESS, OP_GRT, "JLT", "JGE" },
+		{ OP_LESSEQ, OP_GRTEQ, "JLE", "JGT" },
+		{ OP_GRT, OP_LESS, "JGT", "JLE" },
+		{ OP_GRTEQ, OP_LESSEQ, "JGE", "JLT" },
+	};
+
+	if (node->type != NODE_OP) return 0;
+
+	op = node->data.op;
+	for (i = 0; i < 6 && tests[i].op != op; i++);
+	if (i == 6) return 0;
+
+	if (op != OP_EQ && op != OP_NOTEQ) {
+		if (node->child[1]->type == NODE_CONST) {
+			if (ast_const_value(node->child[1]) != 0) return 0;
+		} else if (node->child[0]->type != NODE_CONST
+			|| ast_const_value(node->child[0]) != 0
+		) {
+			return 0;
+		}
+	}
+
+	if (node->child[1]->type == NODE_CONST) {
+		value = ast_const_value(node->child[1]);
+		traverse(node->child[0], NO_SIBLING);
+	} else if (node->child[0]->type == NODE_CONST) {
+		/* c < x is x > c */
+		value = ast_const_value(node->child[0]);
+		traverse(node->child[1], NO_SIBLING);
+		op = tests[i].swapped;
+		for (i = 0; tests[i].op != op; i++);
+	} else {
+		if (flags.regalloc) {
+			expr_operands(node, AC, &lhs, &rhs);
+		} else {
+			traverse(node->child[0], NO_SIBLING);
+			emitRM("ST", AC, tmp_offset--, FP, "Store LHS");
+			traverse(node->child[1], NO_SIBLING);
+			emitRM("LDA", AC1, 0, AC, "Move RHS");
+			emitRM("LD", AC, ++tmp_offset, FP, "Load LHS");
+			lhs = AC;
+			rhs = AC1;
+		}
+		emitRO("SUB", AC, lhs, rhs, "Compare operands");
+		value = 0;
+	}
+
+	if (value != 0) emitRM("LDA", AC, -value, AC, "Compare with constant");
+
+	jump.addr = emitSkip(1);
+	jump.cmd = (char*) (sense ? tests[i].jump_true : tests[i].jump_false);
+	jump.reg = AC;
+	jumps->push_back(jump);
+
+	return 1;
+}
+
+/* Generates the body of an inlined call in place. The arguments are already
+ * stored where the parameters of a frame at frame(FP) live, so the body runs
+ * in that frame as if it had been called. A return jumps to the end of the
+ * body, where the caller's FP is restored.
+ */
+void inline_body(ast_t* call, int frame) {
+	int saved_offset;
+	ast_t* func;
+	ast_t* saved_func;
+	std::vector<int>* saved_returns;
+	std::vector<int>::iterator addr;
+
+	func = (ast_t*) sem_symtab.lookupGlobal(call->data.name);
+
+	saved_func = curr_func;
+	saved_offset = tmp_offset;
+	saved_returns = return_addrs;
+	curr_func = func;
+	tmp_offset = func->data.mem.size;
+	return_addrs = new std::vector<int>();
+
+	emitComment("INLINE", call->data.name);
+	emitRM("LDA", FP, frame, FP, "Load addr of inlined frame");
+	traverse(func->child[1]);
+
+	if (func->data.type != TYPE_VOID && ast_can_complete(func->child[1])) {
+		emitRM("LDC", RT, 0, NONE, "Set return value to 0");
+	}
+
+	for (addr = return_addrs->begin(); addr != return_addrs->end(); addr++) {
+		backPatchAJumpToHere(*addr, "RETURN from inlined body [BACKPATCH]");
+	}
+	emitRM("LDA", FP, -frame, FP, "Restore FP");
+	emitRM("LDA", AC, 0, RT, "Save result in AC");
+
+	delete return_addrs;
+	curr_func = saved_func;
+	tmp_offset = saved_offset;
+	return_addrs = saved_returns;
+
+	return;
+}
+
+/* Generates a call in tail position as a jump that reuses the current
+ * frame. The arguments overwrite the parameters of the current frame, so an
+ * argument goes through a temporary unless no later argument reads the
+ * frame. A self-recursive call jumps past the prologue, as the return
+ * address is already in place, and any other callee gets it back in AC.
+ * Returns 0 if the frame cannot be reused.
+ */
+int tail_call(ast_t* call) {
+	int i;
+	int saved_offset;
+	char str[16];
+	ast_t* param;
+	std::vector<int> temps;
+
+	/* an inlined body has no frame of its own, and a leaf would leave FP
+	 * for this function's caller to restore
+	 */
+	if (!flags.tail_calls || return_addrs || call->data.is_inline) return 0;
+	if (leaf_funcs.count(call->data.name)) return 0;
+
+	/* a local array would be overwritten by the callee's frame */
+	for (param = call->child[0]; param; param = param->sibling) {
+		if (param->type == NODE_ID && param->data.is_array
+			&& param->data.mem.scope == SCOPE_LOCAL
+		) {
+			return 0;
+		}
+	}
+
+	emitComment("TAIL CALL", call->data.name);
+
+	/* keep the temporaries clear of the callee's parameters */
+	saved_offset = tmp_offset;
+	for (i = 0, param = call->child[0]; param; param = param->sibling) i++;
+	if (tmp_offset > -2 - i) tmp_offset = -2 - i;
+
+	i = 0;
+	for (param = call->child[0]; param; param = param->sibling) {
+		snprintf(str, sizeof(str), "%i", ++i);
+		emitComment("LOAD PARAM", str);
+		traverse(param, NO_SIBLING);
+		if (uses_frame(param->sibling)) {
+			temps.push_back(tmp_offset);
+			emitRM("ST", AC, tmp_offset--, FP, "Store argument");
+		} else {
+			temps.push_back(0);
+			emitRM("ST", AC, -1 - i, FP, "Store parameter");
+		}
+	}
+
+	for (i = 0; i < (int) temps.size(); i++) {
+		if (temps[i] == 0) continue;
+		emitRM("LD", AC, temps[i], FP, "Load argument");
+		emitRM("ST", AC, -2 - i, FP, "Store parameter");
+	}
+	tmp_offset = saved_offset;
+
+	if (curr_func && !strcmp(curr_func->data.name, call->data.name)) {
+		emitRMAbs("LDA", PC, func_addr[call->data.name] + 1,
+			"TAIL CALL", call->data.name);
+		num_self_tail_calls++;
+	} else {
+		emitRM("LD", AC, -1, FP, "Load return address");
+		emitRMAbs("LDA", PC, func_addr[call->data.name],
+			"TAIL CALL", call->data.name);
+		num_tail_calls++;
+	}
+
+	return 1;
+}
+
+/* Checks whether any expression in a list reads a local or a parameter */
+int uses_frame(ast_t* node) {
+	int i;
+
+	for (; node; node = node->sibling) {
+		if (node->type == NODE_ID && (node->data.mem.scope == SCOPE_LOCAL
+			|| node->data.mem.scope == SCOPE_PARAM)
+		) {
+			return 1;
+		}
+		for (i = 0; i < node->num_children; i++) {
+			if (uses_frame(node->child[i])) return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Checks whether a function makes no calls, counting those in the bodies
+ * of the calls it inlines. A leaf keeps its return address in AC3 instead
+ * of its frame, so its expressions only use the registers up to AC2.
+ */
+int is_leaf(ast_t* func) {
+	if (!flags.leaf) return 0;
+
+	return !has_call(func->child[1]);
+}
+
+int has_call(ast_t* node) {
+	int i;
+	ast_t* callee;
+
+	for (; node; node = node->sibling) {
+		if (node->type == NODE_CALL) {
+			if (!node->data.is_inline) return 1;
+			callee = (ast_t*) sem_symtab.lookupGlobal(node->data.name);
+			if (has_call(callee->child[1])) return 1;
+		}
+		for (i = 0; i < node->num_children; i++) {
+			if (has_call(node->child[i])) return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Returns from the current function */
+void emit_return() {
+	if (curr_leaf) {
+		emitRM("LDA", PC, 0, AC3, "Return");
+		return;
+	}
+
+	emitRM("LD", AC, -1, FP, "Load return address");
+	emitRM("LD", FP, 0, FP, "Adjust FP");
+	emitRM("LDA", PC, 0, AC, "Return");
+
+	return;
+}
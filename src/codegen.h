@@ -4,5 +4,7 @@
 #include "ast.h"
 
 void codegen(ast_t* tree, FILE* fout);
+int codegen_func_addr(const char* name);
+int codegen_is_leaf(const char* name);
 
 #endif /* _CODEGEN_H_ */
@@ -0,0 +1,211 @@
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "ast.h"
+#include "dce.h"
+#include "stats.h"
+
+/* Dead code elimination removes code that can never run. Functions that
+ * cannot be reached from main through the call graph, and globals that no
+ * reachable function refers to, are marked unused and are neither
+ * generated nor initialized. The IO library functions are treated like any
+ * other function.
+ *
+ * Within a function, the statements of a block that follow a return, a
+ * break or any other statement that never completes are cut off. The
+ * branches of an if and the body of a while that a constant condition
+ * rules out are removed too.
+ */
+
+static void find_uses(ast_t* node);
+static int prune_list(ast_t* list);
+static int prune_stmt(ast_t* stmt);
+static void make_empty(ast_t* node);
+static int count_stmts(ast_t* list);
+
+static std::map<std::string, ast_t*> funcs;
+static std::vector<ast_t*> worklist;
+static std::set<ast_t*> scanned;
+static std::set<int> used_globals;
+static int num_stmts;
+
+ast_t* dce_eliminate(ast_t* tree) {
+	int num_funcs;
+	int num_globals;
+	ast_t* node;
+	ast_t* func;
+
+	funcs.clear();
+	worklist.clear();
+	scanned.clear();
+	used_globals.clear();
+	num_stmts = 0;
+	num_funcs = 0;
+	num_globals = 0;
+
+	for (node = tree; node; node = node->sibling) {
+		if (node->type != NODE_FUNC) continue;
+		funcs[std::string(node->data.name)] = node;
+		node->data.is_unused = 1;
+	}
+
+	/* walk the call graph from main */
+	if (funcs.count("main")) {
+		funcs["main"]->data.is_unused = 0;
+		scanned.insert(funcs["main"]);
+		worklist.push_back(funcs["main"]);
+	}
+	while (!worklist.empty()) {
+		func = worklist.back();
+		worklist.pop_back();
+		prune_stmt(func->child[1]);
+		find_uses(func->child[1]);
+	}
+
+	for (node = tree; node; node = node->sibling) {
+		if (node->type == NODE_FUNC && node->data.is_unused) {
+			num_funcs++;
+		} else if (node->type == NODE_VAR
+			&& node->data.mem.scope == SCOPE_GLOBAL
+			&& !used_globals.count(node->data.mem.loc)
+		) {
+			node->data.is_unused = 1;
+			num_globals++;
+		}
+	}
+
+	stats_count("dce", "unreachable statements removed", num_stmts);
+	stats_count("dce", "unused functions removed", num_funcs);
+	stats_count("dce", "unused globals removed", num_globals);
+
+	return tree;
+}
+
+/* Marks the functions called and the globals used in a subtree. The body
+ * of a function whose calls are inlined is scanned, but the function itself
+ * stays unused unless it is also called. Globals are told apart by their
+ * location, since locals can shadow their names.
+ */
+void find_uses(ast_t* node) {
+	int i;
+	ast_t* callee;
+
+	for (; node; node = node->sibling) {
+		if (node->type == NODE_CALL && funcs.count(node->data.name)) {
+			callee = funcs[std::string(node->data.name)];
+			if (!node->data.is_inline) callee->data.is_unused = 0;
+			if (!scanned.count(callee)) {
+				scanned.insert(callee);
+				worklist.push_back(callee);
+			}
+		} else if (node->type == NODE_ID
+			&& node->data.mem.scope == SCOPE_GLOBAL
+		) {
+			used_globals.insert(node->data.mem.loc);
+		}
+
+		for (i = 0; i < node->num_children; i++) {
+			find_uses(node->child[i]);
+		}
+	}
+
+	return;
+}
+
+/* Prunes a list of statements and returns whether control can reach the
+ * end of the list.
+ */
+int prune_list(ast_t* list) {
+	ast_t* stmt;
+
+	for (stmt = list; stmt; stmt = stmt->sibling) {
+		if (!prune_stmt(stmt)) {
+			num_stmts += count_stmts(stmt->sibling);
+			stmt->sibling = NULL;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Prunes a statement and returns whether it can complete normally */
+int prune_stmt(ast_t* stmt) {
+	int then_ends;
+	int else_ends;
+	ast_t* cond;
+	ast_t* sibling;
+
+	if (stmt == NULL) return 1;
+
+	switch (stmt->type) {
+		case NODE_BREAK:
+		case NODE_RETURN:
+			return 0;
+
+		case NODE_COMPOUND:
+			return prune_list(stmt->child[1]);
+
+		case NODE_IF:
+			cond = stmt->child[0];
+			if (cond->type == NODE_CONST) {
+				/* keep only the branch that is taken */
+				if (ast_const_value(cond)) {
+					num_stmts += count_stmts(stmt->child[2]);
+					stmt->child[2] = NULL;
+				} else {
+					num_stmts += count_stmts(stmt->child[1]);
+					stmt->child[1] = stmt->child[2];
+					stmt->child[2] = NULL;
+				}
+				if (stmt->child[1] == NULL) {
+					make_empty(stmt);
+					return 1;
+				}
+				sibling = stmt->sibling;
+				*stmt = *stmt->child[1];
+				stmt->sibling = sibling;
+				return prune_stmt(stmt);
+			}
+			then_ends = !prune_stmt(stmt->child[1]);
+			else_ends = stmt->child[2] && !prune_stmt(stmt->child[2]);
+			return !(then_ends && else_ends);
+
+		case NODE_WHILE:
+			cond = stmt->child[0];
+			if (cond->type == NODE_CONST && !ast_const_value(cond)) {
+				num_stmts += count_stmts(stmt->child[1]);
+				make_empty(stmt);
+				return 1;
+			}
+			prune_stmt(stmt->child[1]);
+			/* while (true) only ends through a break */
+			return cond->type != NODE_CONST || ast_has_break(stmt->child[1]);
+	}
+
+	return 1;
+}
+
+/* Turns a statement into an empty block, keeping its place in the list */
+void make_empty(ast_t* node) {
+	int i;
+
+	node->type = NODE_COMPOUND;
+	for (i = 0; i < node->num_children; i++) {
+		node->child[i] = NULL;
+	}
+	node->num_children = 0;
+
+	return;
+}
+
+int count_stmts(ast_t* list) {
+	int count;
+
+	for (count = 0; list; list = list->sibling) count++;
+
+	return count;
+}
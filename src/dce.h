@@ -0,0 +1,8 @@
+#ifndef _DCE_H_
+#define _DCE_H_
+
+#include "ast.h"
+
+ast_t* dce_eliminate(ast_t* tree);
+
+#endif /* _DCE_H_ */
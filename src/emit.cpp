@@ -1,11 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <vector>
 #include "emit.h"
 
+static void emitLine(char *line);
+static void emitBuffered(int kind, char *op, int r, int s, int t, int d,
+    int target, char *c, char *cc);
+
+typedef struct {
+    int loc;
+    char *text;
+} line_t;
+
 static int emitLoc = 0;
 static int litLoc = 0;
 static FILE* code;
+static int buffered = 0;
+static std::vector<instr_t> instrs;
+static std::vector<line_t> lines;
 
 void emitSetFile(FILE* f) {
 	code = f;
@@ -17,6 +31,14 @@ void emitSetFile(FILE* f) {
 // 
 void emitComment(char *c, char *cc)
 {
+    std::string line;
+
+    if (buffered) {
+        line = std::string("* ") + c + " " + cc + "\n";
+        emitLine((char *) line.c_str());
+        return;
+    }
+
     fprintf(code, "* %s %s\n", c, cc);
 }
 
@@ -25,6 +47,14 @@ void emitComment(char *c, char *cc)
 // 
 void emitComment(char *c)
 {
+    std::string line;
+
+    if (buffered) {
+        line = std::string("* ") + c + "\n";
+        emitLine((char *) line.c_str());
+        return;
+    }
+
     fprintf(code, "* %s\n", c);
 }
 
@@ -39,6 +69,11 @@ void emitComment(char *c)
 // 
 void emitRO(char *op, int r, int s, int t, char *c, char *cc)
 {
+    if (buffered) {
+        emitBuffered(INSTR_RO, op, r, s, t, 0, -1, c, cc);
+        return;
+    }
+
     fprintf(code, "%3d:  %5s  %d,%d,%d\t%s %s\n", emitLoc, op, r, s, t, c, cc);
     fflush(code);
     emitLoc++;
@@ -60,6 +95,12 @@ void emitRO(char *op, int r, int s, int t, char *c)
 // 
 void emitRM(char *op, int r, int d, int s, char *c, char *cc)
 {
+    if (buffered) {
+        emitBuffered(INSTR_RM, op, r, s, 0, d,
+            s == PC ? emitLoc + 1 + d : -1, c, cc);
+        return;
+    }
+
     fprintf(code, "%3d:  %5s  %d,%d(%d)\t%s %s\n", emitLoc, op, r, d, s, c, cc);
     fflush(code);
     emitLoc++;
@@ -94,6 +135,11 @@ void emitGoto(int d, int s, char *c)
 // 
 void emitRMAbs(char *op, int r, int a, char *c, char *cc)
 {
+    if (buffered) {
+        emitBuffered(INSTR_RM, op, r, PC, 0, a - (emitLoc + 1), a, c, cc);
+        return;
+    }
+
     fprintf(code, "%3d:  %5s  %d,%d(%d)\t%s %s\n", emitLoc, op, r, a - (emitLoc + 1),
 	    PC, c, cc);
     fflush(code);
@@ -122,13 +168,51 @@ void emitGotoAbs(int a, char *c)
 // emit a literal instruction
 void emitLit(char *s)
 {
+    char *line;
+
     litLoc += strlen(s);
-    fprintf(code, "%3d:  %5s  \"%s\"\n", litLoc, (char *)"LIT", s);
+    if (buffered) {
+        line = (char *) malloc(strlen(s) + 32);
+        sprintf(line, "%3d:  %5s  \"%s\"\n", litLoc, (char *)"LIT", s);
+        emitLine(line);
+        free(line);
+    } else {
+        fprintf(code, "%3d:  %5s  \"%s\"\n", litLoc, (char *)"LIT", s);
+    }
     emitRM((char *)"LDC", 3, litLoc, 6, (char *)"Load literal value");
     litLoc++;
 }
 
 
+// emitData emits a directive for the loader to store a value at
+// address a of data memory before the program starts
+// a = the absolute data address
+// value = the value to store there
+// c = a comment to be printed if TraceCode is TRUE
+// 
+void emitData(int a, int value, char *c, char *cc)
+{
+    char head[64];
+    std::string line;
+
+    sprintf(head, "%3d:  %5s  %d\t", a, (char *)"DATA", value);
+    line = std::string(head) + c + " " + cc + "\n";
+
+    if (buffered) {
+        emitLine((char *) line.c_str());
+        return;
+    }
+
+    fputs(line.c_str(), code);
+}
+
+
+void emitData(int a, int value, char *c)
+{
+    emitData(a, value, c, (char *)"");
+}
+
+
 // 
 //  Backpatching Functions
 // 
@@ -183,3 +267,130 @@ void backPatchAJumpToHere(char *cmd, int reg, int addr, char *comment)
 }
 
 
+
+
+// 
+//  Buffering Functions
+// 
+
+// emitStartBuffer collects instructions and comments in memory
+// instead of writing them, so they can be optimized as a whole
+// before emitFlushBuffer writes them out.
+// 
+void emitStartBuffer()
+{
+    buffered = 1;
+    instrs.clear();
+    lines.clear();
+}
+
+
+// emitGetBuffer returns the buffered instructions, indexed by their
+// address. Slots that were skipped and never filled are INSTR_NONE.
+// 
+instr_t *emitGetBuffer(int *count)
+{
+    *count = instrs.size();
+
+    return instrs.empty() ? NULL : &instrs[0];
+}
+
+
+// emitFlushBuffer writes the buffered code, leaving out deleted
+// instructions. The remaining instructions are numbered again and
+// every PC relative operand is resolved against the new numbering.
+// A reference to a deleted instruction goes to the next one kept.
+// Comments stay in front of the instruction they were emitted before.
+// 
+void emitFlushBuffer()
+{
+    int i;
+    int n;
+    int loc;
+    unsigned int line;
+    instr_t *in;
+    std::vector<int> newLoc;
+
+    n = instrs.size();
+    newLoc.resize(n + 1);
+    loc = 0;
+    for (i = 0; i < n; i++) {
+        newLoc[i] = loc;
+        if (instrs[i].kind != INSTR_NONE && !instrs[i].deleted) loc++;
+    }
+    newLoc[n] = loc;
+
+    line = 0;
+    for (i = 0; i < n; i++) {
+        for (; line < lines.size() && lines[line].loc <= i; line++) {
+            fputs(lines[line].text, code);
+        }
+
+        in = &instrs[i];
+        if (in->kind == INSTR_NONE || in->deleted) continue;
+
+        if (in->kind == INSTR_RO) {
+            fprintf(code, "%3d:  %5s  %d,%d,%d\t%s %s\n", newLoc[i], in->op,
+                in->r, in->s, in->t, in->c, in->cc);
+        } else {
+            if (in->target >= 0) {
+                in->d = newLoc[in->target < n ? in->target : n]
+                    - (newLoc[i] + 1);
+            }
+            fprintf(code, "%3d:  %5s  %d,%d(%d)\t%s %s\n", newLoc[i], in->op,
+                in->r, in->d, in->s, in->c, in->cc);
+        }
+    }
+    for (; line < lines.size(); line++) fputs(lines[line].text, code);
+    fflush(code);
+
+    buffered = 0;
+    emitLoc = loc;
+}
+
+
+// emitLine keeps a line of text to be written in front of the
+// instruction at the current location
+// 
+static void emitLine(char *line)
+{
+    unsigned int i;
+    line_t l;
+
+    l.loc = emitLoc;
+    l.text = strdup(line);
+
+    // backpatching can go back, but lines stay in address order
+    i = lines.size();
+    lines.push_back(l);
+    while (i > 0 && lines[i - 1].loc > l.loc) {
+        lines[i] = lines[i - 1];
+        i--;
+    }
+    lines[i] = l;
+}
+
+
+static void emitBuffered(int kind, char *op, int r, int s, int t, int d,
+    int target, char *c, char *cc)
+{
+    instr_t *in;
+
+    if ((int) instrs.size() <= emitLoc) {
+        instrs.resize(emitLoc + 1);
+    }
+
+    in = &instrs[emitLoc];
+    in->kind = kind;
+    in->op = op;
+    in->r = r;
+    in->s = s;
+    in->t = t;
+    in->d = d;
+    in->target = target;
+    in->deleted = 0;
+    in->c = strdup(c);
+    in->cc = strdup(cc);
+
+    emitLoc++;
+}
@@ -17,6 +17,26 @@
 
 #define TraceCode   1
 
+// A buffered instruction. Operands relative to the PC are also kept as
+// the absolute address they refer to, in target, so instructions can be
+// removed before the code is written out.
+#define INSTR_NONE  0
+#define INSTR_RO    1
+#define INSTR_RM    2
+
+typedef struct {
+    int kind;
+    char *op;
+    int r;
+    int s;
+    int t;
+    int d;
+    int target;
+    int deleted;
+    char *c;
+    char *cc;
+} instr_t;
+
 void emitSetFile(FILE* f);
 void emitBackup(int loc);
 void emitComment(char *c);
@@ -34,6 +54,11 @@ void emitRO(char *op, int r, int s, int t, char *c, char *cc);
 void backPatchAJumpToHere(int addr, char *comment);
 void backPatchAJumpToHere(char *cmd, int reg, int addr, char *comment);
 void emitLit(char *s);
+void emitData(int a, int value, char *c);
+void emitData(int a, int value, char *c, char *cc);
 int emitSkip(int howMany);
+void emitStartBuffer();
+instr_t *emitGetBuffer(int *count);
+void emitFlushBuffer();
 
 #endif
@@ -1,11 +1,42 @@
 #ifndef _FLAGS_H_
 #define _FLAGS_H_
 
+/* The flags are hashed byte for byte into the compilation cache key, so
+ * they must only hold plain values.
+ */
 typedef struct {
+	int alloc_profile;
+	int cache;
+	int perf;
+	int stats;
 	int yydebug;
 	int symtab_debug;
 	int print_ast;
 	int print_aug_ast;
+	int emit_ir;
+	int time_passes;
+
+	/* Optimizations, set by passes_configure() */
+	int addressing;
+	int copyprop;
+	int data_image;
+	int dce;
+	int dse;
+	int fold;
+	int fused_branch;
+	int gvn;
+	int inlining;
+	int ir;
+	int leaf;
+	int licm;
+	int peephole;
+	int regalloc;
+	int rmw;
+	int short_circuit;
+	int strength;
+	int tail_calls;
+	int threading;
+	int unroll;
 } flags_t;
 
 #endif /* _FLAGS_H_ */
@@ -0,0 +1,274 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ast.h"
+#include "fold.h"
+#include "stats.h"
+
+/* Constant folding runs on the analyzed tree, between semantic analysis and
+ * code generation. Operators whose operands are all constants are replaced
+ * by their value, and operators with an identity operand, such as x * 1,
+ * are replaced by the other operand. Folding works bottom up, so folded
+ * operands make their parents foldable in turn.
+ *
+ * Values follow the TM machine: integers wrap at 32 bits and division
+ * truncates toward zero. Division by zero is left for the machine to trap.
+ * An operand with side effects is never dropped, so x * 0 is only folded
+ * when x is pure.
+ */
+
+static void fold(ast_t* node);
+static void fold_op(ast_t* node);
+static int fold_binary(ast_t* node, int lhs, int rhs, int* value);
+static int fold_identity(ast_t* node);
+static int is_value(ast_t* node, int value);
+static void make_const(ast_t* node, int value);
+static void replace(ast_t* node, ast_t* with);
+
+static int num_folds;
+static int num_identities;
+
+ast_t* fold_constants(ast_t* tree) {
+	num_folds = 0;
+	num_identities = 0;
+
+	fold(tree);
+
+	stats_count("fold", "constant expressions folded", num_folds);
+	stats_count("fold", "algebraic identities applied", num_identities);
+
+	return tree;
+}
+
+void fold(ast_t* node) {
+	int i;
+
+	for (; node; node = node->sibling) {
+		for (i = 0; i < node->num_children; i++) {
+			fold(node->child[i]);
+		}
+
+		if (node->type == NODE_OP) fold_op(node);
+	}
+
+	return;
+}
+
+void fold_op(ast_t* node) {
+	int value;
+	ast_t* lhs;
+	ast_t* rhs;
+
+	lhs = node->child[0];
+	rhs = node->num_children > 1 ? node->child[1] : NULL;
+
+	switch (node->data.op) {
+		case OP_NEG:
+			if (lhs->type == NODE_CONST) {
+				value = ast_const_value(lhs);
+				make_const(node, (int) (0U - (unsigned int) value));
+				num_folds++;
+				return;
+			}
+			break;
+		case OP_NOT:
+			if (lhs->type == NODE_CONST) {
+				make_const(node, !ast_const_value(lhs));
+				num_folds++;
+				return;
+			}
+			break;
+		case OP_SIZE:
+			/* only the size of an array parameter is unknown */
+			if (lhs->data.mem.scope != SCOPE_PARAM) {
+				make_const(node, lhs->data.mem.size - 1);
+				num_folds++;
+				return;
+			}
+			break;
+		case OP_QMARK:
+		case OP_SUBSC:
+			break;
+		default:
+			if (lhs && rhs && lhs->type == NODE_CONST && rhs->type == NODE_CONST
+				&& fold_binary(node, ast_const_value(lhs), ast_const_value(rhs),
+					&value)
+			) {
+				make_const(node, value);
+				num_folds++;
+				return;
+			}
+			break;
+	}
+
+	if (fold_identity(node)) num_identities++;
+
+	return;
+}
+
+int fold_binary(ast_t* node, int lhs, int rhs, int* value) {
+	switch (node->data.op) {
+		case OP_ADD:
+			*value = (int) ((unsigned int) lhs + (unsigned int) rhs);
+			break;
+		case OP_SUB:
+			*value = (int) ((unsigned int) lhs - (unsigned int) rhs);
+			break;
+		case OP_MUL:
+			*value = (int) ((unsigned int) lhs * (unsigned int) rhs);
+			break;
+		case OP_DIV:
+			if (rhs == 0 || (lhs == INT_MIN && rhs == -1)) return 0;
+			*value = lhs / rhs;
+			break;
+		case OP_MOD:
+			if (rhs == 0 || (lhs == INT_MIN && rhs == -1)) return 0;
+			*value = lhs - (lhs / rhs) * rhs;
+			break;
+		case OP_AND:
+			*value = lhs && rhs;
+			break;
+		case OP_OR:
+			*value = lhs || rhs;
+			break;
+		case OP_EQ:
+			*value = lhs == rhs;
+			break;
+		case OP_NOTEQ:
+			*value = lhs != rhs;
+			break;
+		case OP_LESS:
+			*value = lhs < rhs;
+			break;
+		case OP_LESSEQ:
+			*value = lhs <= rhs;
+			break;
+		case OP_GRT:
+			*value = lhs > rhs;
+			break;
+		case OP_GRTEQ:
+			*value = lhs >= rhs;
+			break;
+		default:
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Replaces an operator that has an identity or absorbing operand. Booleans
+ * are always 0 or 1, so b and true is b itself.
+ */
+int fold_identity(ast_t* node) {
+	ast_t* lhs;
+	ast_t* rhs;
+
+	lhs = node->child[0];
+	rhs = node->num_children > 1 ? node->child[1] : NULL;
+
+	switch (node->data.op) {
+		case OP_ADD:
+			if (is_value(rhs, 0)) {
+				replace(node, lhs);
+			} else if (is_value(lhs, 0)) {
+				replace(node, rhs);
+			} else {
+				return 0;
+			}
+			break;
+		case OP_SUB:
+			if (!is_value(rhs, 0)) return 0;
+			replace(node, lhs);
+			break;
+		case OP_MUL:
+			if (is_value(rhs, 1)) {
+				replace(node, lhs);
+			} else if (is_value(lhs, 1)) {
+				replace(node, rhs);
+			} else if (is_value(rhs, 0) && ast_is_pure(lhs)) {
+				make_const(node, 0);
+			} else if (is_value(lhs, 0) && ast_is_pure(rhs)) {
+				make_const(node, 0);
+			} else {
+				return 0;
+			}
+			break;
+		case OP_AND:
+			if (is_value(rhs, 1)) {
+				replace(node, lhs);
+			} else if (is_value(lhs, 1)) {
+				replace(node, rhs);
+			} else if (is_value(rhs, 0) && ast_is_pure(lhs)) {
+				make_const(node, 0);
+			} else if (is_value(lhs, 0) && ast_is_pure(rhs)) {
+				make_const(node, 0);
+			} else {
+				return 0;
+			}
+			break;
+		case OP_OR:
+			if (is_value(rhs, 0)) {
+				replace(node, lhs);
+			} else if (is_value(lhs, 0)) {
+				replace(node, rhs);
+			} else if (is_value(rhs, 1) && ast_is_pure(lhs)) {
+				make_const(node, 1);
+			} else if (is_value(lhs, 1) && ast_is_pure(rhs)) {
+				make_const(node, 1);
+			} else {
+				return 0;
+			}
+			break;
+		case OP_NEG:
+		case OP_NOT:
+			/* - - x and not not b */
+			if (lhs->type != NODE_OP || lhs->data.op != node->data.op) return 0;
+			replace(node, lhs->child[0]);
+			break;
+		default:
+			return 0;
+	}
+
+	return 1;
+}
+
+int is_value(ast_t* node, int value) {
+	return node && node->type == NODE_CONST && ast_const_value(node) == value;
+}
+
+/* Turns an operator node into a constant of the operator's type in place,
+ * so the parent's child pointer stays valid.
+ */
+void make_const(ast_t* node, int value) {
+	int i;
+
+	node->type = NODE_CONST;
+	node->data.op = OP_NONE;
+	node->data.is_const = 1;
+
+	if (node->data.type == TYPE_BOOL) {
+		node->data.bool_val = value;
+	} else {
+		node->data.int_val = value;
+	}
+
+	for (i = 0; i < node->num_children; i++) {
+		node->child[i] = NULL;
+	}
+	node->num_children = 0;
+
+	return;
+}
+
+/* Overwrites a node with one of its operands, keeping its place in the
+ * sibling list.
+ */
+void replace(ast_t* node, ast_t* with) {
+	ast_t* sibling;
+
+	sibling = node->sibling;
+	*node = *with;
+	node->sibling = sibling;
+
+	return;
+}
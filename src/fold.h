@@ -0,0 +1,8 @@
+#ifndef _FOLD_H_
+#define _FOLD_H_
+
+#include "ast.h"
+
+ast_t* fold_constants(ast_t* tree);
+
+#endif /* _FOLD_H_ */
@@ -0,0 +1,154 @@
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "ast.h"
+#include "inline.h"
+#include "stats.h"
+
+/* The inliner picks the calls that codegen expands in place instead of
+ * jumping to the callee. An inlined call still gets the callee's frame on
+ * top of the caller's temporaries, with the arguments stored where the
+ * parameters live, so the body is generated as it would be for a call. What
+ * goes away is saving the old FP and the return address, the jumps in and
+ * out and the epilogue.
+ *
+ * A call is inlined when the callee is not recursive, directly or through
+ * other functions, and its body is small, counting the bodies of the calls
+ * it inlines in turn. A function called from a single place is inlined up
+ * to a larger size, as dead code elimination can then drop its own copy.
+ */
+
+#define INLINE_MAX_SIZE 24
+#define INLINE_ONCE_SIZE 200
+
+static void find_calls(ast_t* node, std::vector<ast_t*>* calls);
+static int reaches(ast_t* from, ast_t* to, std::set<ast_t*>* seen);
+static int inline_cost(ast_t* func);
+static void mark_calls(ast_t* func);
+
+static std::map<std::string, ast_t*> funcs;
+static std::map<ast_t*, std::vector<ast_t*> > calls;
+static std::map<ast_t*, int> sites;
+static std::map<ast_t*, int> cost;
+static std::set<ast_t*> recursive;
+static int num_inlined;
+
+ast_t* inline_calls(ast_t* tree) {
+	ast_t* node;
+	ast_t* callee;
+	std::vector<ast_t*>::iterator call;
+	std::set<ast_t*> seen;
+
+	funcs.clear();
+	calls.clear();
+	sites.clear();
+	cost.clear();
+	recursive.clear();
+	num_inlined = 0;
+
+	/* the IO library has no body to inline */
+	for (node = tree; node; node = node->sibling) {
+		if (node->type != NODE_FUNC || node->child[1] == NULL) continue;
+		funcs[std::string(node->data.name)] = node;
+	}
+
+	for (node = tree; node; node = node->sibling) {
+		if (node->type != NODE_FUNC || node->child[1] == NULL) continue;
+		find_calls(node->child[1], &calls[node]);
+		for (call = calls[node].begin(); call != calls[node].end(); call++) {
+			sites[funcs[(*call)->data.name]]++;
+		}
+	}
+
+	for (node = tree; node; node = node->sibling) {
+		if (!calls.count(node)) continue;
+		seen.clear();
+		for (call = calls[node].begin(); call != calls[node].end(); call++) {
+			callee = funcs[(*call)->data.name];
+			if (callee == node || reaches(callee, node, &seen)) {
+				recursive.insert(node);
+				break;
+			}
+		}
+	}
+
+	for (node = tree; node; node = node->sibling) {
+		if (calls.count(node)) mark_calls(node);
+	}
+
+	stats_count("inline", "calls inlined", num_inlined);
+
+	return tree;
+}
+
+/* Collects the calls to functions that have a body */
+void find_calls(ast_t* node, std::vector<ast_t*>* found) {
+	int i;
+
+	for (; node; node = node->sibling) {
+		if (node->type == NODE_CALL && funcs.count(node->data.name)) {
+			found->push_back(node);
+		}
+		for (i = 0; i < node->num_children; i++) {
+			find_calls(node->child[i], found);
+		}
+	}
+
+	return;
+}
+
+int reaches(ast_t* from, ast_t* to, std::set<ast_t*>* seen) {
+	ast_t* callee;
+	std::vector<ast_t*>::iterator call;
+
+	if (seen->count(from)) return 0;
+	seen->insert(from);
+
+	for (call = calls[from].begin(); call != calls[from].end(); call++) {
+		callee = funcs[(*call)->data.name];
+		if (callee == to || reaches(callee, to, seen)) return 1;
+	}
+
+	return 0;
+}
+
+/* Returns the size of a non-recursive function once its own calls have been
+ * inlined. Its callees are not recursive either, so this always ends.
+ */
+int inline_cost(ast_t* func) {
+	mark_calls(func);
+
+	return cost[func];
+}
+
+/* Marks the calls in a function that are worth inlining */
+void mark_calls(ast_t* func) {
+	int size;
+	int callee_size;
+	ast_t* callee;
+	std::vector<ast_t*>::iterator call;
+
+	if (cost.count(func)) return;
+
+	size = ast_size(func->child[1]);
+	for (call = calls[func].begin(); call != calls[func].end(); call++) {
+		callee = funcs[(*call)->data.name];
+		if (recursive.count(callee)) continue;
+
+		callee_size = inline_cost(callee);
+		if (callee_size <= INLINE_MAX_SIZE
+			|| (sites[callee] == 1 && callee_size <= INLINE_ONCE_SIZE)
+		) {
+			(*call)->data.is_inline = 1;
+			size += callee_size - 1;
+			num_inlined++;
+		}
+	}
+
+	cost[func] = size;
+
+	return;
+}
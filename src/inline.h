@@ -0,0 +1,8 @@
+#ifndef _INLINE_H_
+#define _INLINE_H_
+
+#include "ast.h"
+
+ast_t* inline_calls(ast_t* tree);
+
+#endif /* _INLINE_H_ */
@@ -0,0 +1,632 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "emit.h"
+#include "ir.h"
+
+/* The IR is a three-address code over an unlimited supply of virtual
+ * registers, each with the type of the values it holds. Variables stay in
+ * memory and are read and written with explicit loads and stores, so a
+ * virtual register holds a value computed once, except for the few that
+ * merge the values of a short circuit or of an inlined call, which are
+ * assigned on several paths.
+ *
+ * A function is a list of basic blocks, each ending in exactly one
+ * terminator: a jump, a two way branch on a register or a return. The
+ * edges of the control-flow graph follow from the terminators, and
+ * ir_cfg() keeps the successor and predecessor lists in step with them.
+ */
+
+static void fail(ir_func_t* func, const char* after, ir_block_t* block,
+	const char* what);
+static void check_use(ir_func_t* func, const char* after, ir_block_t* block,
+	std::vector<char>* defined, ir_operand_t op);
+static int is_ptr(ir_func_t* func, ir_operand_t op);
+static ir_block_t* forward(ir_func_t* func, ir_block_t* block);
+static int intersect(std::vector<int>* idom, std::vector<int>* rpo_num,
+	int a, int b);
+static void print_operand(FILE* out, ir_operand_t op);
+static void print_address(FILE* out, ir_instr_t* in);
+
+static const char* op_names[] = {
+	"add", "and", "div", "eq", "ge", "gt", "le", "lt", "mul", "ne", "or",
+	"sub", "copy", "neg", "not", "rnd", "addr", "load", "store", "in",
+	"out", "outnl", "call", "br", "jump", "ret"
+};
+
+static const char* type_names[] = { "bool", "char", "int", "ptr" };
+
+int ir_new_vreg(ir_func_t* func, ir_type_t type) {
+	func->vtype.push_back(type);
+
+	return func->vtype.size() - 1;
+}
+
+ir_operand_t ir_vreg(int vreg) {
+	ir_operand_t op;
+
+	op.kind = IR_VREG;
+	op.value = vreg;
+
+	return op;
+}
+
+ir_operand_t ir_imm(int value) {
+	ir_operand_t op;
+
+	op.kind = IR_IMM;
+	op.value = value;
+
+	return op;
+}
+
+int ir_is_binary(ir_op_t op) {
+	return op <= IR_SUB;
+}
+
+int ir_is_compare(ir_op_t op) {
+	switch (op) {
+		case IR_EQ:
+		case IR_GE:
+		case IR_GT:
+		case IR_LE:
+		case IR_LT:
+		case IR_NE:
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Checks whether an operation only computes its result, so that it can be
+ * dropped when the result is unused. Division can trap, and a load cannot
+ * as long as its address was computed by the program.
+ */
+int ir_is_pure(ir_op_t op) {
+	switch (op) {
+		case IR_DIV:
+		case IR_RND:
+		case IR_STORE:
+		case IR_IN:
+		case IR_OUT:
+		case IR_OUTNL:
+		case IR_CALL:
+		case IR_BRANCH:
+		case IR_JUMP:
+		case IR_RET:
+			return 0;
+	}
+
+	return 1;
+}
+
+int ir_is_terminator(ir_op_t op) {
+	return op == IR_BRANCH || op == IR_JUMP || op == IR_RET;
+}
+
+int ir_has_call(ir_func_t* func) {
+	unsigned int i;
+	unsigned int j;
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		for (j = 0; j < func->blocks[i]->code.size(); j++) {
+			if (func->blocks[i]->code[j].op == IR_CALL) return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Rebuilds the edges of the control-flow graph from the terminators. Jumps
+ * to a block that only jumps on are sent straight to where it goes, and
+ * blocks that cannot be reached from the entry are deleted.
+ */
+void ir_cfg(ir_func_t* func) {
+	int t;
+	unsigned int i;
+	ir_block_t* block;
+	ir_instr_t* last;
+	std::vector<ir_block_t*> work;
+	std::vector<ir_block_t*> kept;
+	std::vector<char> reached;
+
+	for (i = 0; i < func->blocks.size(); i++) func->blocks[i]->id = i;
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		last = &func->blocks[i]->code.back();
+		for (t = 0; t < 2; t++) {
+			if (last->target[t]) {
+				last->target[t] = forward(func, last->target[t]);
+			}
+		}
+	}
+
+	reached.assign(func->blocks.size(), 0);
+	reached[0] = 1;
+	work.push_back(func->blocks[0]);
+	while (!work.empty()) {
+		block = work.back();
+		work.pop_back();
+		last = &block->code.back();
+		for (t = 0; t < 2; t++) {
+			if (last->target[t] == NULL || reached[last->target[t]->id]) {
+				continue;
+			}
+			reached[last->target[t]->id] = 1;
+			work.push_back(last->target[t]);
+		}
+	}
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		if (reached[i]) {
+			kept.push_back(func->blocks[i]);
+		} else {
+			delete func->blocks[i];
+		}
+	}
+	func->blocks = kept;
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		func->blocks[i]->id = i;
+		func->blocks[i]->succ.clear();
+		func->blocks[i]->pred.clear();
+	}
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		last = &block->code.back();
+		for (t = 0; t < 2; t++) {
+			if (last->target[t] == NULL) continue;
+			block->succ.push_back(last->target[t]);
+			last->target[t]->pred.push_back(block);
+		}
+	}
+
+	return;
+}
+
+/* Follows a chain of blocks holding nothing but a jump. A chain can only
+ * loop back on itself in an infinite loop, which is left alone.
+ */
+ir_block_t* forward(ir_func_t* func, ir_block_t* block) {
+	unsigned int n;
+
+	for (n = 0; n < func->blocks.size(); n++) {
+		if (block->code.size() != 1 || block->code[0].op != IR_JUMP) break;
+		block = block->code[0].target[0];
+	}
+
+	return block;
+}
+
+/* Deletes the pure instructions whose results are not used, and then
+ * those that only computed their operands.
+ */
+void ir_sweep(ir_func_t* func) {
+	int changed;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	ir_instr_t* in;
+	std::vector<int> uses;
+	std::vector<ir_instr_t> code;
+
+	do {
+		changed = 0;
+		uses.assign(func->vtype.size(), 0);
+		for (i = 0; i < func->blocks.size(); i++) {
+			for (j = 0; j < func->blocks[i]->code.size(); j++) {
+				in = &func->blocks[i]->code[j];
+				if (in->a.kind == IR_VREG) uses[in->a.value]++;
+				if (in->b.kind == IR_VREG) uses[in->b.value]++;
+				for (k = 0; k < in->args.size(); k++) {
+					if (in->args[k].kind == IR_VREG) {
+						uses[in->args[k].value]++;
+					}
+				}
+			}
+		}
+
+		for (i = 0; i < func->blocks.size(); i++) {
+			code.clear();
+			for (j = 0; j < func->blocks[i]->code.size(); j++) {
+				in = &func->blocks[i]->code[j];
+				if (in->dst >= 0 && uses[in->dst] == 0
+					&& ir_is_pure(in->op)
+				) {
+					changed = 1;
+					continue;
+				}
+				code.push_back(*in);
+			}
+			func->blocks[i]->code = code;
+		}
+	} while (changed);
+
+	return;
+}
+
+/* Finds the immediate dominator of every block, by the iterative algorithm
+ * of Cooper, Harvey and Kennedy over the blocks in reverse postorder. The
+ * entry block is its own immediate dominator.
+ */
+void ir_dominators(ir_func_t* func, std::vector<int>* idom) {
+	int b;
+	int p;
+	int dom;
+	int changed;
+	unsigned int i;
+	unsigned int j;
+	ir_block_t* block;
+	std::vector<int> order;
+	std::vector<int> rpo_num;
+	std::vector<unsigned int> next;
+	std::vector<ir_block_t*> stack;
+
+	/* postorder by depth first search */
+	rpo_num.assign(func->blocks.size(), -1);
+	next.assign(func->blocks.size(), 0);
+	rpo_num[0] = 0;
+	stack.push_back(func->blocks[0]);
+	while (!stack.empty()) {
+		block = stack.back();
+		if (next[block->id] < block->succ.size()) {
+			b = block->succ[next[block->id]++]->id;
+			if (rpo_num[b] < 0) {
+				rpo_num[b] = 0;
+				stack.push_back(func->blocks[b]);
+			}
+			continue;
+		}
+		order.push_back(block->id);
+		stack.pop_back();
+	}
+	std::reverse(order.begin(), order.end());
+	for (i = 0; i < order.size(); i++) rpo_num[order[i]] = i;
+
+	idom->assign(func->blocks.size(), -1);
+	(*idom)[0] = 0;
+	do {
+		changed = 0;
+		for (i = 1; i < order.size(); i++) {
+			block = func->blocks[order[i]];
+			dom = -1;
+			for (j = 0; j < block->pred.size(); j++) {
+				p = block->pred[j]->id;
+				if ((*idom)[p] < 0) continue;
+				dom = dom < 0 ? p : intersect(idom, &rpo_num, p, dom);
+			}
+			if ((*idom)[block->id] != dom) {
+				(*idom)[block->id] = dom;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	return;
+}
+
+int intersect(std::vector<int>* idom, std::vector<int>* rpo_num, int a,
+	int b
+) {
+	while (a != b) {
+		while ((*rpo_num)[a] > (*rpo_num)[b]) a = (*idom)[a];
+		while ((*rpo_num)[b] > (*rpo_num)[a]) b = (*idom)[b];
+	}
+
+	return a;
+}
+
+/* Checks the invariants the passes rely on, and stops the compiler when
+ * one of them does not hold, naming the pass that broke it:
+ *
+ * - every block ends in its only terminator, whose targets are blocks of
+ *   the function, and the edge lists match the terminators;
+ * - every register is defined on every path to each of its uses;
+ * - pointers are only stored, passed, offset by an integer or used as an
+ *   address, and comparisons produce booleans.
+ */
+void ir_verify(ir_func_t* func, const char* after) {
+	int t;
+	int ptr;
+	int changed;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	ir_block_t* block;
+	ir_instr_t* in;
+	std::vector<std::vector<char> > defined_out;
+	std::vector<char> defined;
+
+	if (func->blocks.empty()) fail(func, after, NULL, "no entry block");
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		if (block->id != (int) i) fail(func, after, block, "stale block id");
+		if (block->code.empty()) fail(func, after, block, "empty block");
+
+		for (j = 0; j < block->code.size(); j++) {
+			in = &block->code[j];
+			if (ir_is_terminator(in->op) != (j == block->code.size() - 1)) {
+				fail(func, after, block, "terminator not at the end");
+			}
+			if (in->dst >= (int) func->vtype.size()) {
+				fail(func, after, block, "undeclared register");
+			}
+		}
+
+		in = &block->code.back();
+		k = 0;
+		for (t = 0; t < 2; t++) {
+			if (in->target[t] == NULL) continue;
+			if (in->target[t]->id < 0
+				|| in->target[t]->id >= (int) func->blocks.size()
+				|| func->blocks[in->target[t]->id] != in->target[t]
+			) {
+				fail(func, after, block, "branch to a foreign block");
+			}
+			if (k >= block->succ.size() || block->succ[k] != in->target[t]) {
+				fail(func, after, block, "successors out of date");
+			}
+			for (j = 0; j < in->target[t]->pred.size(); j++) {
+				if (in->target[t]->pred[j] == block) break;
+			}
+			if (j == in->target[t]->pred.size()) {
+				fail(func, after, block, "predecessors out of date");
+			}
+			k++;
+		}
+		if (k != block->succ.size()) {
+			fail(func, after, block, "successors out of date");
+		}
+		if ((in->op == IR_JUMP && k != 1) || (in->op == IR_BRANCH && k != 2)
+			|| (in->op == IR_RET && k != 0)
+		) {
+			fail(func, after, block, "wrong number of targets");
+		}
+	}
+
+	/* a register is defined on entry to a block if it is defined at the
+	 * end of all of its predecessors
+	 */
+	defined_out.assign(func->blocks.size(),
+		std::vector<char>(func->vtype.size(), 1));
+	do {
+		changed = 0;
+		for (i = 0; i < func->blocks.size(); i++) {
+			block = func->blocks[i];
+			defined.assign(func->vtype.size(), i != 0);
+			for (j = 0; j < block->pred.size(); j++) {
+				for (k = 0; k < defined.size(); k++) {
+					defined[k] &= defined_out[block->pred[j]->id][k];
+				}
+			}
+			for (j = 0; j < block->code.size(); j++) {
+				if (block->code[j].dst >= 0) defined[block->code[j].dst] = 1;
+			}
+			if (defined != defined_out[i]) {
+				defined_out[i] = defined;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		defined.assign(func->vtype.size(), i != 0);
+		for (j = 0; j < block->pred.size(); j++) {
+			for (k = 0; k < defined.size(); k++) {
+				defined[k] &= defined_out[block->pred[j]->id][k];
+			}
+		}
+
+		for (j = 0; j < block->code.size(); j++) {
+			in = &block->code[j];
+			check_use(func, after, block, &defined, in->a);
+			check_use(func, after, block, &defined, in->b);
+			for (k = 0; k < in->args.size(); k++) {
+				check_use(func, after, block, &defined, in->args[k]);
+			}
+
+			switch (in->op) {
+				case IR_ADD:
+				case IR_SUB:
+					ptr = is_ptr(func, in->a)
+						|| (in->op == IR_ADD && is_ptr(func, in->b));
+					if ((is_ptr(func, in->a) && is_ptr(func, in->b))
+						|| (in->op == IR_SUB && is_ptr(func, in->b))
+						|| ptr != (func->vtype[in->dst] == IR_PTR)
+					) {
+						fail(func, after, block, "bad pointer arithmetic");
+					}
+					break;
+				case IR_ADDR:
+					if (func->vtype[in->dst] != IR_PTR) {
+						fail(func, after, block, "address is not a pointer");
+					}
+					break;
+				case IR_LOAD:
+				case IR_STORE:
+					if (in->a.kind == IR_NONE
+						? in->base != GP && in->base != FP
+						: !is_ptr(func, in->a)
+					) {
+						fail(func, after, block, "bad address");
+					}
+					break;
+				case IR_COPY:
+					ptr = func->vtype[in->dst] == IR_PTR;
+					if (is_ptr(func, in->a) != ptr) {
+						fail(func, after, block, "copy changes pointer type");
+					}
+					break;
+				case IR_BRANCH:
+				case IR_NEG:
+				case IR_NOT:
+				case IR_OUT:
+				case IR_RND:
+					if (is_ptr(func, in->a)) {
+						fail(func, after, block, "pointer used as a value");
+					}
+					break;
+				default:
+					if (!ir_is_binary(in->op)) break;
+					if (is_ptr(func, in->a) || is_ptr(func, in->b)) {
+						fail(func, after, block, "pointer used as a value");
+					}
+					if (ir_is_compare(in->op)
+						&& func->vtype[in->dst] != IR_BOOL
+					) {
+						fail(func, after, block, "comparison is not bool");
+					}
+					break;
+			}
+
+			if (in->dst >= 0) defined[in->dst] = 1;
+		}
+	}
+
+	return;
+}
+
+void check_use(ir_func_t* func, const char* after, ir_block_t* block,
+	std::vector<char>* defined, ir_operand_t op
+) {
+	if (op.kind != IR_VREG) return;
+
+	if (op.value < 0 || op.value >= (int) func->vtype.size()) {
+		fail(func, after, block, "undeclared register");
+	}
+	if (!(*defined)[op.value]) {
+		fail(func, after, block, "register used before it is defined");
+	}
+
+	return;
+}
+
+int is_ptr(ir_func_t* func, ir_operand_t op) {
+	return op.kind == IR_VREG && func->vtype[op.value] == IR_PTR;
+}
+
+void fail(ir_func_t* func, const char* after, ir_block_t* block,
+	const char* what
+) {
+	fprintf(stderr, "ERROR(IR): %s", what);
+	if (block) fprintf(stderr, " in B%i", block->id);
+	fprintf(stderr, " of %s after %s\n", func->name, after);
+	ir_print(stderr, func);
+	abort();
+}
+
+void ir_print(FILE* out, ir_func_t* func) {
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	ir_block_t* block;
+	ir_instr_t* in;
+
+	fprintf(out, "function %s frame %i\n", func->name, func->frame);
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		fprintf(out, "B%i:", block->id);
+		if (!block->pred.empty()) fprintf(out, "\t\t\t\t; preds");
+		for (j = 0; j < block->pred.size(); j++) {
+			fprintf(out, " B%i", block->pred[j]->id);
+		}
+		fprintf(out, "\n");
+
+		for (j = 0; j < block->code.size(); j++) {
+			in = &block->code[j];
+			fprintf(out, "\t");
+			if (in->dst >= 0) {
+				fprintf(out, "v%i:%s = ", in->dst,
+					type_names[func->vtype[in->dst]]);
+			}
+			fprintf(out, "%s", op_names[in->op]);
+			if (in->op == IR_IN || in->op == IR_OUT) {
+				fprintf(out, ".%s", type_names[in->type]);
+			}
+
+			switch (in->op) {
+				case IR_ADDR:
+				case IR_LOAD:
+					fprintf(out, " ");
+					print_address(out, in);
+					break;
+				case IR_STORE:
+					fprintf(out, " ");
+					print_address(out, in);
+					fprintf(out, ", ");
+					print_operand(out, in->b);
+					break;
+				case IR_CALL:
+					fprintf(out, " %s(", in->name);
+					for (k = 0; k < in->args.size(); k++) {
+						if (k) fprintf(out, ", ");
+						print_operand(out, in->args[k]);
+					}
+					fprintf(out, ")%s", in->is_tail ? " tail" : "");
+					break;
+				case IR_BRANCH:
+					fprintf(out, " ");
+					print_operand(out, in->a);
+					fprintf(out, ", B%i, B%i", in->target[0]->id,
+						in->target[1]->id);
+					break;
+				case IR_JUMP:
+					fprintf(out, " B%i", in->target[0]->id);
+					break;
+				default:
+					if (in->a.kind != IR_NONE) {
+						fprintf(out, " ");
+						print_operand(out, in->a);
+					}
+					if (in->b.kind != IR_NONE) {
+						fprintf(out, ", ");
+						print_operand(out, in->b);
+					}
+					break;
+			}
+
+			if (in->name && in->op != IR_CALL) {
+				fprintf(out, "\t\t; %s", in->name);
+			}
+			fprintf(out, "\n");
+		}
+	}
+
+	fprintf(out, "\n");
+
+	return;
+}
+
+void print_operand(FILE* out, ir_operand_t op) {
+	if (op.kind == IR_VREG) {
+		fprintf(out, "v%i", op.value);
+	} else {
+		fprintf(out, "%i", op.value);
+	}
+
+	return;
+}
+
+void print_address(FILE* out, ir_instr_t* in) {
+	if (in->a.kind == IR_VREG) {
+		fprintf(out, "[v%i%+i]", in->a.value, in->disp);
+	} else {
+		fprintf(out, "%s[%i]", in->base == GP ? "GP" : "FP", in->disp);
+	}
+
+	return;
+}
+
+void ir_free(ir_func_t* func) {
+	unsigned int i;
+
+	for (i = 0; i < func->blocks.size(); i++) delete func->blocks[i];
+	delete func;
+
+	return;
+}
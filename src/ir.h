@@ -0,0 +1,121 @@
+#ifndef _IR_H_
+#define _IR_H_
+
+#include <stdio.h>
+#include <vector>
+#include "ast.h"
+
+typedef enum {
+	/* dst = a op b */
+	IR_ADD,
+	IR_AND,
+	IR_DIV,
+	IR_EQ,
+	IR_GE,
+	IR_GT,
+	IR_LE,
+	IR_LT,
+	IR_MUL,
+	IR_NE,
+	IR_OR,
+	IR_SUB,
+
+	/* dst = op a */
+	IR_COPY,
+	IR_NEG,
+	IR_NOT,
+	IR_RND,
+
+	/* memory */
+	IR_ADDR,
+	IR_LOAD,
+	IR_STORE,
+
+	/* IO */
+	IR_IN,
+	IR_OUT,
+	IR_OUTNL,
+
+	IR_CALL,
+
+	/* terminators */
+	IR_BRANCH,
+	IR_JUMP,
+	IR_RET,
+} ir_op_t;
+
+typedef enum {
+	IR_BOOL,
+	IR_CHAR,
+	IR_INT,
+	IR_PTR,
+} ir_type_t;
+
+/* Operand kinds */
+#define IR_NONE 0
+#define IR_VREG 1
+#define IR_IMM  2
+
+typedef struct {
+	int kind;
+	int value;
+} ir_operand_t;
+
+struct _ir_block;
+
+/* A memory operation addresses disp(base) when a is not a register, with
+ * base GP or FP, and disp(a) otherwise. A store writes b there. is_elem
+ * tells array elements, which may also be reached through any pointer,
+ * from scalar variables, which are only ever addressed directly.
+ */
+typedef struct {
+	ir_op_t op;
+	int dst;
+	ir_operand_t a;
+	ir_operand_t b;
+	int base;
+	int disp;
+	int is_elem;
+	int is_tail;
+	ir_type_t type;
+	char* name;
+	std::vector<ir_operand_t> args;
+	struct _ir_block* target[2];
+} ir_instr_t;
+
+struct _ir_block {
+	int id;
+	std::vector<ir_instr_t> code;
+	std::vector<struct _ir_block*> succ;
+	std::vector<struct _ir_block*> pred;
+};
+typedef struct _ir_block ir_block_t;
+
+/* The blocks are kept in layout order, starting with the entry block. The
+ * variables of the function and of the bodies it inlines lie above frame,
+ * the first free offset from FP.
+ */
+typedef struct {
+	char* name;
+	ast_t* node;
+	int frame;
+	std::vector<ir_block_t*> blocks;
+	std::vector<ir_type_t> vtype;
+} ir_func_t;
+
+int ir_new_vreg(ir_func_t* func, ir_type_t type);
+ir_operand_t ir_vreg(int vreg);
+ir_operand_t ir_imm(int value);
+int ir_is_binary(ir_op_t op);
+int ir_is_compare(ir_op_t op);
+int ir_is_pure(ir_op_t op);
+int ir_is_terminator(ir_op_t op);
+int ir_has_call(ir_func_t* func);
+void ir_cfg(ir_func_t* func);
+void ir_sweep(ir_func_t* func);
+void ir_dominators(ir_func_t* func, std::vector<int>* idom);
+void ir_verify(ir_func_t* func, const char* after);
+void ir_print(FILE* out, ir_func_t* func);
+void ir_free(ir_func_t* func);
+
+#endif /* _IR_H_ */
@@ -0,0 +1,756 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "ast.h"
+#include "emit.h"
+#include "flags.h"
+#include "ir.h"
+#include "ir_build.h"
+#include "symtab.h"
+
+/* Lowers the body of a function from the analyzed syntax tree into the IR.
+ * Expressions are evaluated left to right into fresh registers, and the
+ * old value of a compound assignment is loaded before its right hand side
+ * is evaluated, as codegen does. Conditions of if and while become
+ * branches, with and, or and not turned into edges when short circuit
+ * evaluation is on, and break jumps to the block after its loop.
+ *
+ * Calls to the IO library become IO instructions. A call marked for
+ * inlining is expanded in place: the callee's variables get a frame of
+ * their own below the caller's, returns assign the result register and
+ * jump to the block after the body.
+ */
+
+static ir_operand_t lower_expr(ast_t* node);
+static ir_operand_t lower_assign(ast_t* node);
+static ir_operand_t lower_call(ast_t* call, int tail);
+static ir_operand_t lower_io(ast_t* call, std::vector<ir_operand_t>* args);
+static ir_operand_t lower_inline(ast_t* callee,
+	std::vector<ir_operand_t>* args);
+static void lower_stmt(ast_t* node);
+static void lower_cond(ast_t* node, ir_block_t* t, ir_block_t* f);
+static void variable(ast_t* var, int offset, ir_instr_t* mem);
+static void element(ast_t* subsc, ir_instr_t* mem);
+static ir_instr_t instr(ir_op_t op);
+static void add(ir_instr_t* in);
+static int def(ir_op_t op, ir_type_t type, ir_operand_t a, ir_operand_t b);
+static void copy(int dst, ir_operand_t value);
+static int terminated();
+static void jump(ir_block_t* target);
+static void branch(ir_operand_t cond, ir_block_t* t, ir_block_t* f);
+static ir_block_t* new_block();
+static void place(ir_block_t* block);
+static ir_type_t value_type(ast_type_t type);
+
+extern flags_t flags;
+extern SymbolTable sem_symtab;
+
+static ir_func_t* func;
+static ir_block_t* curr;
+static int bias;
+static int inline_frame;
+static ir_block_t* ret_block;
+static int ret_vreg;
+static std::vector<ir_block_t*> breaks;
+static int failed;
+
+ir_func_t* ir_build(ast_t* node) {
+	ir_instr_t ret;
+
+	func = new ir_func_t;
+	func->name = node->data.name;
+	func->node = node;
+	func->frame = node->data.mem.size;
+
+	curr = NULL;
+	bias = 0;
+	inline_frame = node->data.mem.size;
+	ret_block = NULL;
+	ret_vreg = -1;
+	breaks.clear();
+	failed = 0;
+
+	place(new_block());
+	lower_stmt(node->child[1]);
+	if (!terminated()) {
+		/* falling off the end returns 0 */
+		ret = instr(IR_RET);
+		ret.a = ir_imm(0);
+		add(&ret);
+	}
+
+	if (failed) {
+		ir_free(func);
+		return NULL;
+	}
+
+	ir_cfg(func);
+	ir_verify(func, "lowering");
+
+	return func;
+}
+
+ir_operand_t lower_expr(ast_t* node) {
+	int c;
+	int i;
+	int result;
+	ir_block_t* rhs;
+	ir_block_t* end;
+	ir_operand_t a;
+	ir_operand_t b;
+	ir_operand_t q;
+	ir_instr_t mem;
+	static const struct {
+		ast_op_t op;
+		ir_op_t ir;
+	} binary[] = {
+		{ OP_ADD, IR_ADD },
+		{ OP_AND, IR_AND },
+		{ OP_DIV, IR_DIV },
+		{ OP_EQ, IR_EQ },
+		{ OP_GRT, IR_GT },
+		{ OP_GRTEQ, IR_GE },
+		{ OP_LESS, IR_LT },
+		{ OP_LESSEQ, IR_LE },
+		{ OP_MUL, IR_MUL },
+		{ OP_NOTEQ, IR_NE },
+		{ OP_OR, IR_OR },
+		{ OP_SUB, IR_SUB },
+		{ OP_NONE, IR_ADD },
+	};
+
+	switch (node->type) {
+		case NODE_ASSIGN:
+			return lower_assign(node);
+
+		case NODE_CALL:
+			return lower_call(node, 0);
+
+		case NODE_CONST:
+			return ir_imm(ast_const_value(node));
+
+		case NODE_ID:
+			mem = instr(IR_LOAD);
+			variable(node, 0, &mem);
+			if (node->data.is_array) {
+				/* a parameter holds the address of its array */
+				if (node->data.mem.scope != SCOPE_PARAM) mem.op = IR_ADDR;
+				mem.dst = ir_new_vreg(func, IR_PTR);
+			} else {
+				mem.dst = ir_new_vreg(func, value_type(node->data.type));
+			}
+			add(&mem);
+			return ir_vreg(mem.dst);
+
+		case NODE_OP:
+			break;
+
+		default:
+			failed = 1;
+			return ir_imm(0);
+	}
+
+	switch (node->data.op) {
+		case OP_NEG:
+			a = lower_expr(node->child[0]);
+			return ir_vreg(def(IR_NEG, IR_INT, a, ir_imm(0)));
+
+		case OP_NOT:
+			a = lower_expr(node->child[0]);
+			return ir_vreg(def(IR_NOT, IR_BOOL, a, ir_imm(0)));
+
+		case OP_QMARK:
+			a = lower_expr(node->child[0]);
+			return ir_vreg(def(IR_RND, IR_INT, a, ir_imm(0)));
+
+		case OP_SIZE:
+			mem = instr(IR_LOAD);
+			if (node->child[0]->data.mem.scope == SCOPE_PARAM) {
+				variable(node->child[0], 0, &mem);
+				mem.dst = ir_new_vreg(func, IR_PTR);
+				add(&mem);
+				mem.a = ir_vreg(mem.dst);
+				mem.disp = 1;
+			} else {
+				variable(node->child[0], 1, &mem);
+			}
+			mem.is_elem = 1;
+			mem.dst = ir_new_vreg(func, IR_INT);
+			add(&mem);
+			return ir_vreg(mem.dst);
+
+		case OP_SUBSC:
+			mem = instr(IR_LOAD);
+			element(node, &mem);
+			mem.dst = ir_new_vreg(func, value_type(node->data.type));
+			add(&mem);
+			return ir_vreg(mem.dst);
+
+		case OP_MOD:
+			/* TM has no shifts, so a power of two is only a mask for a
+			 * dividend that cannot be negative
+			 */
+			c = node->child[1]->type == NODE_CONST
+				? ast_const_value(node->child[1]) : 0;
+			if (flags.strength && (c == 1 || c == -1)) {
+				lower_expr(node->child[0]);
+				return ir_imm(0);
+			}
+			if (flags.strength && c > 1 && (c & (c - 1)) == 0
+				&& ast_non_negative(node->child[0])
+			) {
+				a = lower_expr(node->child[0]);
+				return ir_vreg(def(IR_AND, IR_INT, a, ir_imm(c - 1)));
+			}
+
+			/* a % b is a - a / b * b */
+			a = lower_expr(node->child[0]);
+			b = lower_expr(node->child[1]);
+			q = ir_vreg(def(IR_DIV, IR_INT, a, b));
+			q = ir_vreg(def(IR_MUL, IR_INT, q, b));
+			return ir_vreg(def(IR_SUB, IR_INT, a, q));
+
+		case OP_AND:
+		case OP_OR:
+			if (!flags.short_circuit) break;
+
+			/* the left operand decides unless it is true for and or
+			 * false for or, and the right one is the value otherwise
+			 */
+			result = ir_new_vreg(func, IR_BOOL);
+			copy(result, lower_expr(node->child[0]));
+
+			rhs = new_block();
+			end = new_block();
+			if (node->data.op == OP_AND) {
+				branch(ir_vreg(result), rhs, end);
+			} else {
+				branch(ir_vreg(result), end, rhs);
+			}
+
+			place(rhs);
+			copy(result, lower_expr(node->child[1]));
+			jump(end);
+
+			place(end);
+			return ir_vreg(result);
+
+		case OP_DOT:
+			failed = 1;
+			return ir_imm(0);
+	}
+
+	for (i = 0; binary[i].op != OP_NONE && binary[i].op != node->data.op; i++);
+	if (binary[i].op == OP_NONE) {
+		failed = 1;
+		return ir_imm(0);
+	}
+
+	a = lower_expr(node->child[0]);
+	b = lower_expr(node->child[1]);
+
+	return ir_vreg(def(binary[i].ir, value_type(node->data.type), a, b));
+}
+
+/* The address of the target is found first, then the old value is loaded
+ * if the operator needs it, and only then is the right hand side evaluated.
+ */
+ir_operand_t lower_assign(ast_t* node) {
+	int i;
+	ir_type_t type;
+	ir_operand_t value;
+	ir_operand_t old;
+	ir_instr_t mem;
+	ir_instr_t load;
+	static const struct {
+		ast_op_t op;
+		ir_op_t ir;
+	} ops[] = {
+		{ OP_ADDASS, IR_ADD },
+		{ OP_DEC, IR_SUB },
+		{ OP_DIVASS, IR_DIV },
+		{ OP_INC, IR_ADD },
+		{ OP_MULASS, IR_MUL },
+		{ OP_SUBASS, IR_SUB },
+		{ OP_ASS, IR_COPY },
+	};
+
+	mem = instr(IR_STORE);
+	if (node->child[0]->type == NODE_ID) {
+		variable(node->child[0], 0, &mem);
+	} else {
+		element(node->child[0], &mem);
+	}
+	type = value_type(node->child[0]->data.type);
+
+	for (i = 0; ops[i].op != OP_ASS && ops[i].op != node->data.op; i++);
+
+	if (ops[i].op == OP_ASS) {
+		value = lower_expr(node->child[1]);
+	} else {
+		load = mem;
+		load.op = IR_LOAD;
+		load.dst = ir_new_vreg(func, type);
+		add(&load);
+		old = ir_vreg(load.dst);
+
+		value = node->child[1] ? lower_expr(node->child[1]) : ir_imm(1);
+		value = ir_vreg(def(ops[i].ir, IR_INT, old, value));
+	}
+
+	mem.b = value;
+	add(&mem);
+
+	return value;
+}
+
+ir_operand_t lower_call(ast_t* call, int tail) {
+	int dst;
+	ast_t* callee;
+	ast_t* arg;
+	ir_instr_t in;
+	std::vector<ir_operand_t> args;
+
+	callee = (ast_t*) sem_symtab.lookupGlobal(call->data.name);
+
+	for (arg = call->child[0]; arg; arg = arg->sibling) {
+		args.push_back(lower_expr(arg));
+	}
+
+	if (callee->child[1] == NULL) return lower_io(call, &args);
+	if (call->data.is_inline) return lower_inline(callee, &args);
+
+	dst = ir_new_vreg(func, value_type(callee->data.type));
+	in = instr(IR_CALL);
+	in.dst = dst;
+	in.name = call->data.name;
+	in.args = args;
+	in.is_tail = tail;
+	add(&in);
+
+	return ir_vreg(dst);
+}
+
+ir_operand_t lower_io(ast_t* call, std::vector<ir_operand_t>* args) {
+	unsigned int i;
+	ir_instr_t in;
+	static const struct {
+		const char* name;
+		ir_op_t op;
+		ir_type_t type;
+	} io[] = {
+		{ "input", IR_IN, IR_INT },
+		{ "inputb", IR_IN, IR_BOOL },
+		{ "inputc", IR_IN, IR_CHAR },
+		{ "output", IR_OUT, IR_INT },
+		{ "outputb", IR_OUT, IR_BOOL },
+		{ "outputc", IR_OUT, IR_CHAR },
+		{ "outnl", IR_OUTNL, IR_INT },
+	};
+
+	for (i = 0; i < sizeof(io) / sizeof(io[0]); i++) {
+		if (!strcmp(io[i].name, call->data.name)) break;
+	}
+	if (i == sizeof(io) / sizeof(io[0])) {
+		failed = 1;
+		return ir_imm(0);
+	}
+
+	in = instr(io[i].op);
+	in.type = io[i].type;
+	if (io[i].op == IR_IN) {
+		in.dst = ir_new_vreg(func, io[i].type);
+		add(&in);
+		return ir_vreg(in.dst);
+	}
+
+	if (io[i].op == IR_OUT) in.a = (*args)[0];
+	add(&in);
+
+	return ir_imm(0);
+}
+
+/* The arguments are stored to the parameters of the callee's frame, which
+ * starts where the frame of the function it is inlined into ends.
+ */
+ir_operand_t lower_inline(ast_t* callee, std::vector<ir_operand_t>* args) {
+	int result;
+	int saved_bias;
+	int saved_frame;
+	int saved_vreg;
+	unsigned int i;
+	ast_t* param;
+	ir_block_t* saved_block;
+	ir_block_t* end;
+	ir_instr_t store;
+
+	param = callee->child[0];
+	for (i = 0; i < args->size(); i++, param = param->sibling) {
+		store = instr(IR_STORE);
+		store.base = FP;
+		store.disp = inline_frame - 2 - i;
+		store.b = (*args)[i];
+		store.name = param->data.name;
+		add(&store);
+	}
+
+	result = ir_new_vreg(func, value_type(callee->data.type));
+	end = new_block();
+
+	saved_bias = bias;
+	saved_frame = inline_frame;
+	saved_block = ret_block;
+	saved_vreg = ret_vreg;
+	bias = inline_frame;
+	inline_frame += callee->data.mem.size;
+	if (inline_frame < func->frame) func->frame = inline_frame;
+	ret_block = end;
+	ret_vreg = result;
+
+	lower_stmt(callee->child[1]);
+	if (!terminated()) {
+		/* the value of a body that falls off its end is 0 */
+		copy(result, ir_imm(0));
+		jump(end);
+	}
+
+	bias = saved_bias;
+	inline_frame = saved_frame;
+	ret_block = saved_block;
+	ret_vreg = saved_vreg;
+
+	place(end);
+
+	return ir_vreg(result);
+}
+
+void lower_stmt(ast_t* node) {
+	int tail;
+	ast_t* arg;
+	ir_block_t* then_block;
+	ir_block_t* else_block;
+	ir_block_t* end;
+	ir_block_t* test;
+	ir_operand_t value;
+	ir_instr_t in;
+
+	for (; node; node = node->sibling) {
+		switch (node->type) {
+			case NODE_BREAK:
+				jump(breaks.back());
+				break;
+
+			case NODE_COMPOUND:
+				lower_stmt(node->child[0]);
+				lower_stmt(node->child[1]);
+				break;
+
+			case NODE_IF:
+				then_block = new_block();
+				end = new_block();
+				else_block = node->child[2] ? new_block() : end;
+
+				lower_cond(node->child[0], then_block, else_block);
+				place(then_block);
+				lower_stmt(node->child[1]);
+				jump(end);
+
+				if (node->child[2]) {
+					place(else_block);
+					lower_stmt(node->child[2]);
+					jump(end);
+				}
+
+				place(end);
+				break;
+
+			case NODE_RETURN:
+				value = ir_imm(0);
+				if (ret_block) {
+					/* return from an inlined body */
+					if (node->child[0]) value = lower_expr(node->child[0]);
+					copy(ret_vreg, value);
+					jump(ret_block);
+					break;
+				}
+
+				/* a tail call cannot reuse the frame while a local array
+				 * passed to it lives there
+				 */
+				if (node->child[0] && node->child[0]->type == NODE_CALL) {
+					tail = flags.tail_calls && !node->child[0]->data.is_inline;
+					for (arg = node->child[0]->child[0]; arg;
+						arg = arg->sibling
+					) {
+						if (arg->type == NODE_ID && arg->data.is_array
+							&& arg->data.mem.scope == SCOPE_LOCAL
+						) {
+							tail = 0;
+						}
+					}
+					value = lower_call(node->child[0], tail);
+				} else if (node->child[0]) {
+					value = lower_expr(node->child[0]);
+				}
+
+				in = instr(IR_RET);
+				if (node->child[0]) in.a = value;
+				add(&in);
+				break;
+
+			case NODE_VAR:
+				if (node->data.mem.scope != SCOPE_LOCAL) break;
+
+				in = instr(IR_STORE);
+				if (node->data.is_array) {
+					variable(node, 1, &in);
+					in.b = ir_imm(node->data.mem.size - 1);
+					in.is_elem = 1;
+				} else if (node->child[0]) {
+					variable(node, 0, &in);
+					in.b = lower_expr(node->child[0]);
+				} else {
+					break;
+				}
+				add(&in);
+				break;
+
+			case NODE_WHILE:
+				test = new_block();
+				then_block = new_block();
+				end = new_block();
+
+				jump(test);
+				place(test);
+				lower_cond(node->child[0], then_block, end);
+
+				breaks.push_back(end);
+				place(then_block);
+				lower_stmt(node->child[1]);
+				jump(test);
+				breaks.pop_back();
+
+				place(end);
+				break;
+
+			default:
+				lower_expr(node);
+				break;
+		}
+	}
+
+	return;
+}
+
+/* Lowers a condition into branches to t when it holds and to f otherwise */
+void lower_cond(ast_t* node, ir_block_t* t, ir_block_t* f) {
+	ir_block_t* rhs;
+
+	if (node->type == NODE_CONST) {
+		jump(ast_const_value(node) ? t : f);
+		return;
+	}
+
+	if (node->type == NODE_OP) {
+		switch (node->data.op) {
+			case OP_AND:
+				if (!flags.short_circuit) break;
+				rhs = new_block();
+				lower_cond(node->child[0], rhs, f);
+				place(rhs);
+				lower_cond(node->child[1], t, f);
+				return;
+			case OP_OR:
+				if (!flags.short_circuit) break;
+				rhs = new_block();
+				lower_cond(node->child[0], t, rhs);
+				place(rhs);
+				lower_cond(node->child[1], t, f);
+				return;
+			case OP_NOT:
+				lower_cond(node->child[0], f, t);
+				return;
+		}
+	}
+
+	branch(lower_expr(node), t, f);
+
+	return;
+}
+
+/* Sets the address of a variable, plus offset, in a memory operation */
+void variable(ast_t* var, int offset, ir_instr_t* mem) {
+	switch (var->data.mem.scope) {
+		case SCOPE_GLOBAL:
+		case SCOPE_STATIC:
+			mem->base = GP;
+			mem->disp = var->data.mem.loc + offset;
+			break;
+		default:
+			mem->base = FP;
+			mem->disp = var->data.mem.loc + offset + bias;
+			break;
+	}
+	mem->name = var->data.name;
+	mem->is_elem = var->data.is_array
+		&& var->data.mem.scope != SCOPE_PARAM;
+
+	return;
+}
+
+/* Sets the address of an array element in a memory operation. Element i
+ * of an array at loc is at loc - i, which is a fixed slot for a constant
+ * index into an array of this frame or a global one. The address of an
+ * array parameter is loaded from its slot.
+ */
+void element(ast_t* subsc, ir_instr_t* mem) {
+	int value;
+	ast_t* var;
+	ir_operand_t index;
+	ir_operand_t array;
+	ir_instr_t in;
+
+	var = subsc->child[0];
+
+	if (subsc->child[1]->type == NODE_CONST
+		&& var->data.mem.scope != SCOPE_PARAM
+	) {
+		value = ast_const_value(subsc->child[1]);
+		variable(var, -value, mem);
+		return;
+	}
+
+	index = lower_expr(subsc->child[1]);
+	array = lower_expr(var);
+
+	if (index.kind == IR_IMM) {
+		mem->a = array;
+		mem->disp = -index.value;
+	} else {
+		mem->a = ir_vreg(def(IR_SUB, IR_PTR, array, index));
+		mem->disp = 0;
+	}
+	mem->name = var->data.name;
+	mem->is_elem = 1;
+
+	return;
+}
+
+ir_instr_t instr(ir_op_t op) {
+	ir_instr_t in;
+
+	in.op = op;
+	in.dst = -1;
+	in.a.kind = IR_NONE;
+	in.a.value = 0;
+	in.b = in.a;
+	in.base = NONE;
+	in.disp = 0;
+	in.is_elem = 0;
+	in.is_tail = 0;
+	in.type = IR_INT;
+	in.name = NULL;
+	in.target[0] = NULL;
+	in.target[1] = NULL;
+
+	return in;
+}
+
+/* Appends an instruction to the current block. Code after a jump or a
+ * return goes into a block of its own, which nothing reaches.
+ */
+void add(ir_instr_t* in) {
+	if (terminated()) place(new_block());
+
+	curr->code.push_back(*in);
+
+	return;
+}
+
+/* Appends dst = a op b to the current block and returns dst. Unary
+ * operations ignore b.
+ */
+int def(ir_op_t op, ir_type_t type, ir_operand_t a, ir_operand_t b) {
+	ir_instr_t in;
+
+	in = instr(op);
+	in.dst = ir_new_vreg(func, type);
+	in.a = a;
+	if (ir_is_binary(op)) in.b = b;
+	add(&in);
+
+	return in.dst;
+}
+
+/* Assigns a register that already has a value on another path */
+void copy(int dst, ir_operand_t value) {
+	ir_instr_t in;
+
+	in = instr(IR_COPY);
+	in.dst = dst;
+	in.a = value;
+	add(&in);
+
+	return;
+}
+
+int terminated() {
+	return !curr->code.empty() && ir_is_terminator(curr->code.back().op);
+}
+
+void jump(ir_block_t* target) {
+	ir_instr_t in;
+
+	in = instr(IR_JUMP);
+	in.target[0] = target;
+	add(&in);
+
+	return;
+}
+
+void branch(ir_operand_t cond, ir_block_t* t, ir_block_t* f) {
+	ir_instr_t in;
+
+	if (cond.kind == IR_IMM) {
+		jump(cond.value ? t : f);
+		return;
+	}
+
+	in = instr(IR_BRANCH);
+	in.a = cond;
+	in.target[0] = t;
+	in.target[1] = f;
+	add(&in);
+
+	return;
+}
+
+ir_block_t* new_block() {
+	ir_block_t* block;
+
+	block = new ir_block_t;
+	block->id = -1;
+
+	return block;
+}
+
+/* Makes a block the next one in layout order and the current one */
+void place(ir_block_t* block) {
+	block->id = func->blocks.size();
+	func->blocks.push_back(block);
+	curr = block;
+
+	return;
+}
+
+ir_type_t value_type(ast_type_t type) {
+	switch (type) {
+		case TYPE_BOOL:
+			return IR_BOOL;
+		case TYPE_CHAR:
+			return IR_CHAR;
+	}
+
+	return IR_INT;
+}
@@ -0,0 +1,9 @@
+#ifndef _IR_BUILD_H_
+#define _IR_BUILD_H_
+
+#include "ast.h"
+#include "ir.h"
+
+ir_func_t* ir_build(ast_t* func);
+
+#endif /* _IR_BUILD_H_ */
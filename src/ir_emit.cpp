@@ -0,0 +1,806 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "codegen.h"
+#include "emit.h"
+#include "flags.h"
+#include "ir.h"
+#include "ir_emit.h"
+#include "stats.h"
+
+/* Lowers a function in the IR to TM code. Virtual registers get a machine
+ * register each by linear scan over the blocks in layout order. A register
+ * is live from its first definition or use to its last, stretched over
+ * every block it is live into or out of, so a loop keeps the registers it
+ * carries around its back edge.
+ *
+ * A call clobbers every register, so a value live across one is spilled to
+ * a slot of its own below the function's variables, as is a value for which
+ * no register is left. The registers from AC up hold values. RT and the
+ * highest one left, AC3, or AC2 in a leaf that keeps its return address in
+ * AC3, load spilled values and constants that an instruction cannot take
+ * as its displacement.
+ *
+ * A comparison whose only use is the branch right after it becomes a
+ * conditional jump on the difference of its operands, as in codegen.
+ */
+
+/* A range starting with a definition may share a register with one that
+ * ends at the same instruction, as operands are read before the result is
+ * written.
+ */
+typedef struct {
+	int vreg;
+	int start;
+	int end;
+	int starts_with_def;
+} interval_t;
+
+typedef struct {
+	int addr;
+	const char* cmd;
+	int reg;
+	ir_block_t* target;
+} fixup_t;
+
+static void count_uses();
+static void find_intervals(std::vector<interval_t>* intervals,
+	std::vector<int>* calls);
+static void allocate(std::vector<interval_t>* intervals,
+	std::vector<int>* calls);
+static int by_start(const interval_t& a, const interval_t& b);
+static void emit_block(ir_block_t* block, ir_block_t* next);
+static void emit_binary(ir_instr_t* in);
+static int emit_reduced(ir_instr_t* in);
+static int can_fuse(ir_instr_t* cmp);
+static void emit_test(ir_instr_t* cmp, ir_instr_t* br, ir_block_t* next);
+static void emit_branch(const char* cmd_true, const char* cmd_false, int reg,
+	ir_instr_t* br, ir_block_t* next);
+static void emit_jump(const char* cmd, int reg, ir_block_t* target);
+static void emit_call(ir_instr_t* in);
+static void emit_tail_call(ir_instr_t* in);
+static void emit_return(ir_operand_t value);
+static int get(ir_operand_t op, int scratch);
+static int target(int vreg);
+static void put(int vreg, int reg);
+
+extern flags_t flags;
+
+static ir_func_t* func;
+static int leaf;
+static int scratch;
+static int num_regs;
+static int ghost;
+static int num_spilled;
+static std::vector<int> reg;
+static std::vector<int> slot;
+static std::vector<int> uses;
+static std::vector<char> fused;
+static std::vector<int> addr;
+static std::vector<fixup_t> fixups;
+static int num_fused;
+
+void ir_emit(ir_func_t* f, int is_leaf) {
+	int end;
+	unsigned int i;
+	std::vector<interval_t> intervals;
+	std::vector<int> calls;
+
+	func = f;
+	leaf = is_leaf;
+	scratch = leaf ? AC2 : AC3;
+	num_regs = scratch - AC;
+	num_spilled = 0;
+	num_fused = 0;
+	reg.assign(func->vtype.size(), -1);
+	slot.assign(func->vtype.size(), 0);
+	addr.assign(func->blocks.size(), -1);
+	fixups.clear();
+
+	count_uses();
+	find_intervals(&intervals, &calls);
+	allocate(&intervals, &calls);
+
+	if (!leaf) emitRM("ST", AC, -1, FP, "Store return address");
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		addr[i] = emitSkip(0);
+		emit_block(func->blocks[i],
+			i + 1 < func->blocks.size() ? func->blocks[i + 1] : NULL);
+	}
+
+	end = emitSkip(0);
+	for (i = 0; i < fixups.size(); i++) {
+		emitBackup(fixups[i].addr);
+		if (fixups[i].cmd) {
+			emitRMAbs((char*) fixups[i].cmd, fixups[i].reg,
+				addr[fixups[i].target->id], "Branch [BACKPATCH]");
+		} else {
+			emitRMAbs("LDA", PC, addr[fixups[i].target->id],
+				"Jump [BACKPATCH]");
+		}
+	}
+	emitBackup(end);
+
+	stats_count("ir", "spilled registers", num_spilled);
+	stats_count("ir", "fused branches", num_fused);
+
+	return;
+}
+
+/* Counts the uses of each register, and finds the comparisons that only
+ * feed the branch right after them.
+ */
+void count_uses() {
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	ir_block_t* block;
+	ir_instr_t* in;
+	ir_instr_t* cmp;
+
+	uses.assign(func->vtype.size(), 0);
+	fused.assign(func->vtype.size(), 0);
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		for (j = 0; j < block->code.size(); j++) {
+			in = &block->code[j];
+			if (in->a.kind == IR_VREG) uses[in->a.value]++;
+			if (in->b.kind == IR_VREG) uses[in->b.value]++;
+			for (k = 0; k < in->args.size(); k++) {
+				if (in->args[k].kind == IR_VREG) uses[in->args[k].value]++;
+			}
+		}
+	}
+
+	if (!flags.fused_branch) return;
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		if (block->code.size() < 2) continue;
+		in = &block->code.back();
+		cmp = &block->code[block->code.size() - 2];
+		if (in->op == IR_BRANCH && in->a.kind == IR_VREG
+			&& ir_is_compare(cmp->op) && cmp->dst == in->a.value
+			&& uses[cmp->dst] == 1 && can_fuse(cmp)
+		) {
+			fused[cmp->dst] = 1;
+		}
+	}
+
+	return;
+}
+
+/* Numbers the instructions in layout order and finds the range of
+ * positions over which each register is live, from the registers live into
+ * and out of each block. Also lists the positions of the calls.
+ */
+void find_intervals(std::vector<interval_t>* intervals,
+	std::vector<int>* calls
+) {
+	int pos;
+	int changed;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	unsigned int v;
+	ir_block_t* block;
+	ir_instr_t* in;
+	std::vector<std::vector<char> > used;
+	std::vector<std::vector<char> > defined;
+	std::vector<std::vector<char> > live_in;
+	std::vector<std::vector<char> > live_out;
+	std::vector<int> start;
+	std::vector<int> end;
+	std::vector<char> starts_with_def;
+	std::vector<ir_operand_t> ops;
+	interval_t interval;
+
+	used.assign(func->blocks.size(), std::vector<char>(func->vtype.size(), 0));
+	defined = used;
+	live_in = used;
+	live_out = used;
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		for (j = 0; j < block->code.size(); j++) {
+			in = &block->code[j];
+			ops = in->args;
+			ops.push_back(in->a);
+			ops.push_back(in->b);
+			for (k = 0; k < ops.size(); k++) {
+				if (ops[k].kind == IR_VREG && !defined[i][ops[k].value]) {
+					used[i][ops[k].value] = 1;
+				}
+			}
+			if (in->dst >= 0) defined[i][in->dst] = 1;
+		}
+	}
+
+	do {
+		changed = 0;
+		for (i = func->blocks.size(); i-- > 0;) {
+			block = func->blocks[i];
+			for (v = 0; v < func->vtype.size(); v++) {
+				for (j = 0; j < block->succ.size(); j++) {
+					if (live_in[block->succ[j]->id][v]) break;
+				}
+				if (j < block->succ.size() && !live_out[i][v]) {
+					live_out[i][v] = 1;
+					changed = 1;
+				}
+				if (!live_in[i][v]
+					&& (used[i][v] || (live_out[i][v] && !defined[i][v]))
+				) {
+					live_in[i][v] = 1;
+					changed = 1;
+				}
+			}
+		}
+	} while (changed);
+
+	start.assign(func->vtype.size(), -1);
+	end.assign(func->vtype.size(), -1);
+	starts_with_def.assign(func->vtype.size(), 0);
+
+	pos = 0;
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		for (v = 0; v < func->vtype.size(); v++) {
+			if (!live_in[i][v]) continue;
+			if (start[v] < 0) start[v] = pos;
+			end[v] = pos;
+		}
+
+		for (j = 0; j < block->code.size(); j++, pos++) {
+			in = &block->code[j];
+			if (in->op == IR_CALL) calls->push_back(pos);
+			ops = in->args;
+			ops.push_back(in->a);
+			ops.push_back(in->b);
+			for (k = 0; k < ops.size(); k++) {
+				if (ops[k].kind != IR_VREG) continue;
+				end[ops[k].value] = pos;
+			}
+			if (in->dst >= 0) {
+				if (start[in->dst] < 0) {
+					start[in->dst] = pos;
+					starts_with_def[in->dst] = 1;
+				}
+				if (end[in->dst] < pos) end[in->dst] = pos;
+			}
+		}
+
+		for (v = 0; v < func->vtype.size(); v++) {
+			if (live_out[i][v]) end[v] = pos - 1;
+		}
+	}
+
+	for (v = 0; v < func->vtype.size(); v++) {
+		if (start[v] < 0 || uses[v] == 0 || fused[v]) continue;
+		interval.vreg = v;
+		interval.start = start[v];
+		interval.end = end[v];
+		interval.starts_with_def = starts_with_def[v];
+		intervals->push_back(interval);
+	}
+
+	return;
+}
+
+/* Linear scan. When no register is free, the value whose range ends last
+ * is spilled, as it would block a register for longest.
+ */
+void allocate(std::vector<interval_t>* intervals, std::vector<int>* calls) {
+	int r;
+	int top;
+	int victim;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	std::vector<int>::iterator call;
+	std::vector<interval_t> active;
+	std::vector<char> taken(AC + num_regs, 0);
+	interval_t cur;
+
+	std::sort(intervals->begin(), intervals->end(), by_start);
+
+	/* spill slots must stay clear of the parameters a tail call stores */
+	top = func->frame;
+	for (i = 0; i < func->blocks.size(); i++) {
+		for (j = 0; j < func->blocks[i]->code.size(); j++) {
+			if (!func->blocks[i]->code[j].is_tail) continue;
+			k = func->blocks[i]->code[j].args.size();
+			if (top > -2 - (int) k) top = -2 - (int) k;
+		}
+	}
+
+	for (i = 0; i < intervals->size(); i++) {
+		cur = (*intervals)[i];
+
+		for (j = 0; j < active.size();) {
+			if (active[j].end < cur.start
+				|| (active[j].end == cur.start && cur.starts_with_def)
+			) {
+				taken[reg[active[j].vreg]] = 0;
+				active.erase(active.begin() + j);
+			} else {
+				j++;
+			}
+		}
+
+		call = std::upper_bound(calls->begin(), calls->end(), cur.start);
+		if (call != calls->end() && *call < cur.end) {
+			slot[cur.vreg] = top - num_spilled++;
+			continue;
+		}
+
+		for (r = AC; r < AC + num_regs && taken[r]; r++);
+		if (r < AC + num_regs) {
+			reg[cur.vreg] = r;
+			taken[r] = 1;
+			active.push_back(cur);
+			continue;
+		}
+
+		victim = 0;
+		for (j = 1; j < active.size(); j++) {
+			if (active[j].end > active[victim].end) victim = j;
+		}
+		if (active[victim].end > cur.end) {
+			reg[cur.vreg] = reg[active[victim].vreg];
+			reg[active[victim].vreg] = -1;
+			slot[active[victim].vreg] = top - num_spilled++;
+			active[victim] = cur;
+		} else {
+			slot[cur.vreg] = top - num_spilled++;
+		}
+	}
+
+	ghost = top - num_spilled;
+
+	return;
+}
+
+int by_start(const interval_t& a, const interval_t& b) {
+	return a.start < b.start;
+}
+
+void emit_block(ir_block_t* block, ir_block_t* next) {
+	int r;
+	unsigned int i;
+	char* name;
+	ir_instr_t* in;
+	static const char* io[] = { "INB", "INC", "IN" };
+	static const char* out[] = { "OUTB", "OUTC", "OUT" };
+
+	for (i = 0; i < block->code.size(); i++) {
+		in = &block->code[i];
+		name = in->name ? in->name : NO_COMMENT;
+
+		if (in->dst >= 0 && fused[in->dst]) {
+			emit_test(in, &block->code[i + 1], next);
+			break;
+		}
+		if (in->dst >= 0 && uses[in->dst] == 0 && ir_is_pure(in->op)) {
+			continue;
+		}
+
+		switch (in->op) {
+			case IR_ADDR:
+				r = target(in->dst);
+				emitRM("LDA", r, in->disp, in->base, "Load address of array",
+					name);
+				put(in->dst, r);
+				break;
+
+			case IR_LOAD:
+				r = target(in->dst);
+				if (in->a.kind == IR_VREG) {
+					emitRM("LD", r, in->disp, get(in->a, RT), "Load element",
+						name);
+				} else {
+					emitRM("LD", r, in->disp, in->base, "Load variable",
+						name);
+				}
+				put(in->dst, r);
+				break;
+
+			case IR_STORE:
+				r = get(in->b, scratch);
+				if (in->a.kind == IR_VREG) {
+					emitRM("ST", r, in->disp, get(in->a, RT), "Store element",
+						name);
+				} else {
+					emitRM("ST", r, in->disp, in->base, "Store variable",
+						name);
+				}
+				break;
+
+			case IR_COPY:
+				if (in->a.kind == IR_IMM) {
+					r = target(in->dst);
+					emitRM("LDC", r, in->a.value, NONE, "Load constant");
+					put(in->dst, r);
+				} else if (reg[in->dst] < 0) {
+					put(in->dst, get(in->a, RT));
+				} else {
+					r = get(in->a, reg[in->dst]);
+					if (r != reg[in->dst]) {
+						emitRM("LDA", reg[in->dst], 0, r, "Copy");
+					}
+				}
+				break;
+
+			case IR_NEG:
+				r = target(in->dst);
+				emitRO("NEG", r, get(in->a, RT), NONE, "UNARY OP -");
+				put(in->dst, r);
+				break;
+
+			case IR_NOT:
+				r = target(in->dst);
+				emitRM("LDC", scratch, 0, NONE, "Load integer constant");
+				emitRO("TEQ", r, get(in->a, RT), scratch, "UNARY OP not");
+				put(in->dst, r);
+				break;
+
+			case IR_RND:
+				r = target(in->dst);
+				emitRO("RND", r, get(in->a, RT), NONE, "UNARY OP ?");
+				put(in->dst, r);
+				break;
+
+			case IR_IN:
+				r = in->dst >= 0 ? target(in->dst) : RT;
+				emitRO((char*) io[in->type], r, NONE, NONE, "Grab input");
+				if (in->dst >= 0) put(in->dst, r);
+				break;
+
+			case IR_OUT:
+				emitRO((char*) out[in->type], get(in->a, RT), NONE, NONE,
+					"Output");
+				break;
+
+			case IR_OUTNL:
+				emitRO("OUTNL", NONE, NONE, NONE, "Output newline");
+				break;
+
+			case IR_CALL:
+				/* the return must use the result of the call */
+				if (in->is_tail && i + 1 < block->code.size()
+					&& block->code[i + 1].op == IR_RET
+					&& block->code[i + 1].a.kind == IR_VREG
+					&& block->code[i + 1].a.value == in->dst
+					&& !codegen_is_leaf(in->name)
+				) {
+					emit_tail_call(in);
+					return;
+				}
+				emit_call(in);
+				break;
+
+			case IR_BRANCH:
+				emit_branch("JNZ", "JZR", get(in->a, RT), in, next);
+				break;
+
+			case IR_JUMP:
+				if (in->target[0] != next) emit_jump(NULL, 0, in->target[0]);
+				break;
+
+			case IR_RET:
+				emit_return(in->a);
+				break;
+
+			default:
+				emit_binary(in);
+				break;
+		}
+	}
+
+	return;
+}
+
+void emit_binary(ir_instr_t* in) {
+	int r;
+	int lhs;
+	static const char* cmds[] = {
+		"ADD", "AND", "DIV", "TEQ", "TGE", "TGT", "TLE", "TLT", "MUL", "TNE",
+		"OR", "SUB"
+	};
+
+	if (emit_reduced(in)) return;
+
+	r = target(in->dst);
+	lhs = get(in->a, RT);
+	emitRO((char*) cmds[in->op], r, lhs, get(in->b, scratch), "OP");
+	put(in->dst, r);
+
+	return;
+}
+
+/* Adds and subtracts a constant with LDA, and with strength reduction on,
+ * multiplies and divides by 2, 1, 0 and -1 without MUL or DIV. Returns 0
+ * if nothing applies.
+ */
+int emit_reduced(ir_instr_t* in) {
+	int c;
+	int r;
+	int lhs;
+	ir_operand_t other;
+
+	if (in->b.kind == IR_IMM) {
+		c = in->b.value;
+		other = in->a;
+	} else if (in->a.kind == IR_IMM
+		&& (in->op == IR_ADD || in->op == IR_MUL)
+	) {
+		c = in->a.value;
+		other = in->b;
+	} else {
+		return 0;
+	}
+
+	r = target(in->dst);
+
+	switch (in->op) {
+		case IR_ADD:
+			emitRM("LDA", r, c, get(other, RT), "OP + constant");
+			break;
+		case IR_SUB:
+			emitRM("LDA", r, -c, get(other, RT), "OP - constant");
+			break;
+		case IR_MUL:
+			if (!flags.strength) return 0;
+			if (c == 0) {
+				emitRM("LDC", r, 0, NONE, "OP * 0");
+			} else if (c == 1) {
+				emitRM("LDA", r, 0, get(other, RT), "OP * 1");
+			} else if (c == 2) {
+				lhs = get(other, RT);
+				emitRO("ADD", r, lhs, lhs, "OP * 2");
+			} else if (c == -1) {
+				emitRO("NEG", r, get(other, RT), NONE, "OP * -1");
+			} else {
+				return 0;
+			}
+			break;
+		case IR_DIV:
+			if (!flags.strength) return 0;
+			if (c == 1) {
+				emitRM("LDA", r, 0, get(other, RT), "OP / 1");
+			} else if (c == -1) {
+				emitRO("NEG", r, get(other, RT), NONE, "OP / -1");
+			} else {
+				return 0;
+			}
+			break;
+		default:
+			return 0;
+	}
+
+	put(in->dst, r);
+
+	return 1;
+}
+
+/* Checks whether a comparison can branch on the difference of its
+ * operands. The difference may wrap around, which still leaves it 0 only
+ * for equal operands, but can flip its sign, so an ordered comparison is
+ * only fused when it is with 0 and there is nothing to subtract.
+ */
+int can_fuse(ir_instr_t* cmp) {
+	if (cmp->op == IR_EQ || cmp->op == IR_NE) return 1;
+
+	return (cmp->a.kind == IR_IMM && cmp->a.value == 0)
+		|| (cmp->b.kind == IR_IMM && cmp->b.value == 0);
+}
+
+/* Emits a comparison and the branch on it as one conditional jump on the
+ * difference of the operands. A constant operand is subtracted with LDA,
+ * and a comparison with 0 tests the other operand directly.
+ */
+void emit_test(ir_instr_t* cmp, ir_instr_t* br, ir_block_t* next) {
+	int i;
+	int r;
+	int value;
+	ir_op_t op;
+	static const struct {
+		ir_op_t op;
+		ir_op_t swapped;
+		const char* jump_true;
+		const char* jump_false;
+	} tests[] = {
+		{ IR_EQ, IR_EQ, "JEQ", "JNE" },
+		{ IR_NE, IR_NE, "JNE", "JEQ" },
+		{ IR_LT, IR_GT, "JLT", "JGE" },
+		{ IR_LE, IR_GE, "JLE", "JGT" },
+		{ IR_GT, IR_LT, "JGT", "JLE" },
+		{ IR_GE, IR_LE, "JGE", "JLT" },
+	};
+
+	op = cmp->op;
+	if (cmp->b.kind == IR_IMM) {
+		value = cmp->b.value;
+		r = get(cmp->a, RT);
+	} else if (cmp->a.kind == IR_IMM) {
+		/* c < x is x > c */
+		value = cmp->a.value;
+		r = get(cmp->b, RT);
+		for (i = 0; tests[i].op != op; i++);
+		op = tests[i].swapped;
+	} else {
+		r = get(cmp->a, RT);
+		emitRO("SUB", RT, r, get(cmp->b, scratch), "Compare operands");
+		r = RT;
+		value = 0;
+	}
+
+	if (value != 0) {
+		emitRM("LDA", RT, -value, r, "Compare with constant");
+		r = RT;
+	}
+
+	for (i = 0; tests[i].op != op; i++);
+	emit_branch(tests[i].jump_true, tests[i].jump_false, r, br, next);
+	num_fused++;
+
+	return;
+}
+
+/* Branches to the first target when a register passes cmd_true and to the
+ * second one otherwise, falling through to whichever comes next.
+ */
+void emit_branch(const char* cmd_true, const char* cmd_false, int reg,
+	ir_instr_t* br, ir_block_t* next
+) {
+	if (br->target[1] == next) {
+		emit_jump(cmd_true, reg, br->target[0]);
+	} else if (br->target[0] == next) {
+		emit_jump(cmd_false, reg, br->target[1]);
+	} else {
+		emit_jump(cmd_true, reg, br->target[0]);
+		emit_jump(NULL, 0, br->target[1]);
+	}
+
+	return;
+}
+
+/* Jumps to a block if cmd holds for reg, or always if there is no cmd. A
+ * jump forward is patched once the target has an address.
+ */
+void emit_jump(const char* cmd, int reg, ir_block_t* target) {
+	fixup_t fixup;
+
+	if (addr[target->id] >= 0) {
+		if (cmd) {
+			emitRMAbs((char*) cmd, reg, addr[target->id], "Branch back");
+		} else {
+			emitRMAbs("LDA", PC, addr[target->id], "Jump back");
+		}
+		return;
+	}
+
+	fixup.addr = emitSkip(1);
+	fixup.cmd = cmd;
+	fixup.reg = reg;
+	fixup.target = target;
+	fixups.push_back(fixup);
+
+	return;
+}
+
+/* Calls as codegen does, with the ghost frame below the spilled values */
+void emit_call(ir_instr_t* in) {
+	unsigned int i;
+	int callee_leaf;
+
+	callee_leaf = codegen_is_leaf(in->name);
+
+	emitComment("CALL", in->name);
+	if (!callee_leaf) {
+		emitRM("ST", FP, ghost, FP, "Store old FP in ghost frame");
+	}
+	for (i = 0; i < in->args.size(); i++) {
+		emitRM("ST", get(in->args[i], RT), ghost - 2 - i, FP,
+			"Store parameter");
+	}
+
+	emitRM("LDA", FP, ghost, FP, "Load addr of new frame");
+	if (callee_leaf) {
+		emitRM("LDA", AC3, 1, PC, "Return addr in AC3");
+		emitRMAbs("LDA", PC, codegen_func_addr(in->name), "CALL", in->name);
+		emitRM("LDA", FP, -ghost, FP, "Restore FP");
+	} else {
+		emitRM("LDA", AC, 1, PC, "Return addr in AC");
+		emitRMAbs("LDA", PC, codegen_func_addr(in->name), "CALL", in->name);
+	}
+
+	if (uses[in->dst] == 0) return;
+
+	if (reg[in->dst] >= 0) {
+		emitRM("LDA", reg[in->dst], 0, RT, "Save result");
+	} else {
+		put(in->dst, RT);
+	}
+
+	return;
+}
+
+/* The arguments already sit in registers or spill slots below the
+ * parameters, so they can be stored over the parameters in any order.
+ */
+void emit_tail_call(ir_instr_t* in) {
+	unsigned int i;
+
+	emitComment("TAIL CALL", in->name);
+	for (i = 0; i < in->args.size(); i++) {
+		emitRM("ST", get(in->args[i], RT), -2 - i, FP, "Store parameter");
+	}
+
+	if (!strcmp(in->name, func->name)) {
+		emitRMAbs("LDA", PC, addr[0], "TAIL CALL", in->name);
+		stats_count("codegen", "self tail calls", 1);
+	} else {
+		emitRM("LD", AC, -1, FP, "Load return address");
+		emitRMAbs("LDA", PC, codegen_func_addr(in->name), "TAIL CALL",
+			in->name);
+		stats_count("codegen", "other tail calls", 1);
+	}
+
+	return;
+}
+
+void emit_return(ir_operand_t value) {
+	if (value.kind == IR_IMM) {
+		emitRM("LDC", RT, value.value, NONE, "Set return value");
+	} else if (value.kind == IR_VREG) {
+		emitRM("LDA", RT, 0, get(value, RT), "Copy result to RT");
+	}
+
+	if (leaf) {
+		emitRM("LDA", PC, 0, AC3, "Return");
+		return;
+	}
+
+	emitRM("LD", AC, -1, FP, "Load return address");
+	emitRM("LD", FP, 0, FP, "Adjust FP");
+	emitRM("LDA", PC, 0, AC, "Return");
+
+	return;
+}
+
+/* Returns a register holding an operand, loading constants and spilled
+ * values into the given scratch register.
+ */
+int get(ir_operand_t op, int scratch_reg) {
+	if (op.kind == IR_IMM) {
+		emitRM("LDC", scratch_reg, op.value, NONE, "Load constant");
+		return scratch_reg;
+	}
+
+	if (reg[op.value] >= 0) return reg[op.value];
+
+	emitRM("LD", scratch_reg, slot[op.value], FP, "Load spilled value");
+
+	return scratch_reg;
+}
+
+/* Returns the register to compute a value into */
+int target(int vreg) {
+	if (vreg >= 0 && reg[vreg] >= 0) return reg[vreg];
+
+	return RT;
+}
+
+/* Stores a value computed into a scratch register to its spill slot */
+void put(int vreg, int r) {
+	if (reg[vreg] >= 0 || uses[vreg] == 0) return;
+
+	emitRM("ST", r, slot[vreg], FP, "Spill value");
+
+	return;
+}
@@ -0,0 +1,8 @@
+#ifndef _IR_EMIT_H_
+#define _IR_EMIT_H_
+
+#include "ir.h"
+
+void ir_emit(ir_func_t* func, int leaf);
+
+#endif /* _IR_EMIT_H_ */
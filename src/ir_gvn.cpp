@@ -0,0 +1,515 @@
+#include <limits.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+#include <vector>
+#include "emit.h"
+#include "ir.h"
+#include "ir_gvn.h"
+#include "stats.h"
+
+/* Global value numbering walks the dominator tree, so that every value
+ * computed in a block is available in the blocks it dominates. Each pure
+ * instruction is looked up by its operation and the value numbers of its
+ * operands. When an earlier instruction already computed the same value,
+ * the uses of the later one are renamed to the earlier register and the
+ * later instruction is deleted. Operations on constants are folded, and a
+ * branch on a constant becomes a jump.
+ *
+ * A load is a value like any other until a store or a call may overwrite
+ * what it read. A store to a scalar variable only overwrites that
+ * variable, while a store to an array element may overwrite any element
+ * of any array, as array parameters are passed by reference. A call never
+ * overwrites the scalar locals of its caller, but it forgets their loads
+ * all the same: a register live across a call is spilled, and reloading it
+ * costs as much as loading the variable again. On entry to a block, the
+ * loads of its dominator are forgotten if a block on a path from the
+ * dominator may overwrite them.
+ *
+ * The address of a variable costs one instruction, as does reloading a
+ * spilled register, so it is numbered to match the expressions built on it
+ * but kept where it is. Registers assigned on several paths, which merge
+ * the values of a short circuit or of an inlined call, are left alone.
+ */
+
+typedef std::vector<int> expr_key_t;
+typedef std::map<expr_key_t, ir_operand_t> table_t;
+
+/* What a stretch of code may overwrite: everything a call may, any array
+ * element, or the listed scalar variables as (base, disp)
+ */
+typedef struct {
+	int call;
+	int elem;
+	std::vector<std::pair<int, int> > slots;
+} writes_t;
+
+static void walk(int b);
+static void kill_paths(int b);
+static void number(ir_block_t* block);
+static int fold(ir_instr_t* in, ir_operand_t* value);
+static int identity(ir_instr_t* in, ir_operand_t* value);
+static int same_type(ir_instr_t* in, ir_operand_t value);
+static void rename(ir_operand_t* op);
+static int make_key(ir_instr_t* in, expr_key_t* key);
+static void operand_key(ir_operand_t op, expr_key_t* key);
+static void add_writes(writes_t* w, ir_instr_t* in);
+static void kill(writes_t* w);
+static void set(expr_key_t* key, ir_operand_t value);
+
+static ir_func_t* func;
+static std::vector<int> idom;
+static std::vector<std::vector<int> > children;
+static std::vector<writes_t> writes;
+static std::vector<int> num_defs;
+static std::vector<int> vn;
+static std::vector<ir_operand_t> repl;
+static table_t table;
+static std::vector<std::pair<expr_key_t, ir_operand_t> > undo;
+static int cfg_changed;
+static int num_eliminated;
+static int num_folded;
+static int num_branches;
+
+void ir_gvn(ir_func_t* f) {
+	unsigned int i;
+	unsigned int j;
+	ir_instr_t* in;
+	ir_operand_t none;
+
+	func = f;
+	cfg_changed = 0;
+	num_eliminated = 0;
+	num_folded = 0;
+	num_branches = 0;
+	table.clear();
+	undo.clear();
+
+	none.kind = IR_NONE;
+	none.value = 0;
+	repl.assign(func->vtype.size(), none);
+	num_defs.assign(func->vtype.size(), 0);
+	vn.resize(func->vtype.size());
+	for (i = 0; i < vn.size(); i++) vn[i] = i;
+
+	writes.assign(func->blocks.size(), writes_t());
+	for (i = 0; i < func->blocks.size(); i++) {
+		writes[i].call = 0;
+		writes[i].elem = 0;
+		for (j = 0; j < func->blocks[i]->code.size(); j++) {
+			in = &func->blocks[i]->code[j];
+			if (in->dst >= 0) num_defs[in->dst]++;
+			add_writes(&writes[i], in);
+		}
+	}
+
+	ir_dominators(func, &idom);
+	children.assign(func->blocks.size(), std::vector<int>());
+	for (i = 1; i < func->blocks.size(); i++) {
+		children[idom[i]].push_back(i);
+	}
+
+	walk(0);
+	ir_sweep(func);
+
+	if (cfg_changed) ir_cfg(func);
+
+	stats_count("gvn", "expressions eliminated", num_eliminated);
+	stats_count("gvn", "constant expressions folded", num_folded);
+	stats_count("gvn", "branches folded", num_branches);
+
+	return;
+}
+
+/* Numbers a block and then the blocks it immediately dominates, and takes
+ * back what they added to the table before returning.
+ */
+void walk(int b) {
+	unsigned int i;
+	unsigned int mark;
+
+	mark = undo.size();
+
+	if (b != 0) kill_paths(b);
+	number(func->blocks[b]);
+
+	for (i = 0; i < children[b].size(); i++) walk(children[b][i]);
+
+	while (undo.size() > mark) {
+		if (undo.back().second.kind == IR_NONE) {
+			table.erase(undo.back().first);
+		} else {
+			table[undo.back().first] = undo.back().second;
+		}
+		undo.pop_back();
+	}
+
+	return;
+}
+
+/* Forgets the loads overwritten by the blocks that lead from the immediate
+ * dominator of a block to it without passing through the dominator again.
+ * These are the predecessors of the block and, going backwards, theirs.
+ */
+void kill_paths(int b) {
+	int p;
+	unsigned int i;
+	ir_block_t* block;
+	std::vector<char> seen;
+	std::vector<int> work;
+	writes_t w;
+
+	block = func->blocks[b];
+	if (block->pred.size() == 1 && block->pred[0]->id == idom[b]) return;
+
+	w.call = 0;
+	w.elem = 0;
+	seen.assign(func->blocks.size(), 0);
+	seen[idom[b]] = 1;
+	for (i = 0; i < block->pred.size(); i++) {
+		work.push_back(block->pred[i]->id);
+	}
+
+	while (!work.empty()) {
+		p = work.back();
+		work.pop_back();
+		if (seen[p]) continue;
+		seen[p] = 1;
+
+		w.call |= writes[p].call;
+		w.elem |= writes[p].elem;
+		w.slots.insert(w.slots.end(), writes[p].slots.begin(),
+			writes[p].slots.end());
+		for (i = 0; i < func->blocks[p]->pred.size(); i++) {
+			work.push_back(func->blocks[p]->pred[i]->id);
+		}
+	}
+
+	kill(&w);
+
+	return;
+}
+
+void number(ir_block_t* block) {
+	int t;
+	unsigned int i;
+	unsigned int k;
+	ir_instr_t* in;
+	ir_operand_t value;
+	std::vector<ir_instr_t> code;
+	table_t::iterator found;
+	expr_key_t key;
+	writes_t w;
+
+	for (i = 0; i < block->code.size(); i++) {
+		in = &block->code[i];
+		rename(&in->a);
+		rename(&in->b);
+		for (k = 0; k < in->args.size(); k++) rename(&in->args[k]);
+
+		if (in->op == IR_BRANCH && in->a.kind == IR_IMM) {
+			t = in->a.value ? 0 : 1;
+			in->op = IR_JUMP;
+			in->target[0] = in->target[t];
+			in->target[1] = NULL;
+			in->a.kind = IR_NONE;
+			cfg_changed = 1;
+			num_branches++;
+		}
+
+		if (in->dst >= 0 && num_defs[in->dst] == 1) {
+			if (fold(in, &value)) {
+				repl[in->dst] = value;
+				num_folded++;
+				continue;
+			}
+			if (identity(in, &value)) {
+				repl[in->dst] = value;
+				num_eliminated++;
+				continue;
+			}
+			if (make_key(in, &key)) {
+				found = table.find(key);
+				if (found == table.end()) {
+					set(&key, ir_vreg(in->dst));
+				} else if (in->op == IR_ADDR) {
+					vn[in->dst] = vn[found->second.value];
+				} else {
+					repl[in->dst] = found->second;
+					num_eliminated++;
+					continue;
+				}
+			}
+		}
+
+		/* a store or a call forgets the loads it may overwrite */
+		w.call = 0;
+		w.elem = 0;
+		w.slots.clear();
+		add_writes(&w, in);
+		kill(&w);
+
+		code.push_back(*in);
+	}
+
+	block->code = code;
+
+	return;
+}
+
+/* Computes an operation on constants as TM would, except for division by
+ * 0, which is left to trap at run time.
+ */
+int fold(ir_instr_t* in, ir_operand_t* value) {
+	int a;
+	int b;
+
+	if (in->a.kind != IR_IMM) return 0;
+	a = in->a.value;
+
+	switch (in->op) {
+		case IR_COPY:
+			*value = in->a;
+			return 1;
+		case IR_NEG:
+			*value = ir_imm((int) (0u - (unsigned int) a));
+			return 1;
+		case IR_NOT:
+			*value = ir_imm(!a);
+			return 1;
+	}
+
+	if (!ir_is_binary(in->op) || in->b.kind != IR_IMM) return 0;
+	b = in->b.value;
+
+	switch (in->op) {
+		case IR_ADD:
+			*value = ir_imm((int) ((unsigned int) a + (unsigned int) b));
+			break;
+		case IR_AND:
+			*value = ir_imm(a & b);
+			break;
+		case IR_DIV:
+			if (b == 0 || (a == INT_MIN && b == -1)) return 0;
+			*value = ir_imm(a / b);
+			break;
+		case IR_EQ:
+			*value = ir_imm(a == b);
+			break;
+		case IR_GE:
+			*value = ir_imm(a >= b);
+			break;
+		case IR_GT:
+			*value = ir_imm(a > b);
+			break;
+		case IR_LE:
+			*value = ir_imm(a <= b);
+			break;
+		case IR_LT:
+			*value = ir_imm(a < b);
+			break;
+		case IR_MUL:
+			*value = ir_imm((int) ((unsigned int) a * (unsigned int) b));
+			break;
+		case IR_NE:
+			*value = ir_imm(a != b);
+			break;
+		case IR_OR:
+			*value = ir_imm(a | b);
+			break;
+		case IR_SUB:
+			*value = ir_imm((int) ((unsigned int) a - (unsigned int) b));
+			break;
+		default:
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Finds operations that give back one of their operands or a constant
+ * whatever the other operand is: copies, x + 0, x - 0, x * 1, x / 1 and
+ * x * 0.
+ */
+int identity(ir_instr_t* in, ir_operand_t* value) {
+	ir_operand_t a;
+	ir_operand_t b;
+
+	a = in->a;
+	b = in->b;
+	if (in->op == IR_COPY) {
+		*value = a;
+		return same_type(in, a);
+	}
+
+	if (!ir_is_binary(in->op)) return 0;
+
+	/* constants second */
+	if (a.kind == IR_IMM && (in->op == IR_ADD || in->op == IR_MUL)) {
+		a = in->b;
+		b = in->a;
+	}
+	if (b.kind != IR_IMM) return 0;
+
+	switch (in->op) {
+		case IR_ADD:
+		case IR_SUB:
+			if (b.value != 0) return 0;
+			*value = a;
+			return same_type(in, a);
+		case IR_MUL:
+			if (b.value == 0) {
+				*value = b;
+				return 1;
+			}
+			/* fall through */
+		case IR_DIV:
+			if (b.value != 1) return 0;
+			*value = a;
+			return same_type(in, a);
+	}
+
+	return 0;
+}
+
+int same_type(ir_instr_t* in, ir_operand_t value) {
+	return value.kind == IR_IMM
+		|| func->vtype[value.value] == func->vtype[in->dst];
+}
+
+void rename(ir_operand_t* op) {
+	if (op->kind == IR_VREG && repl[op->value].kind != IR_NONE) {
+		*op = repl[op->value];
+	}
+
+	return;
+}
+
+/* Builds the key under which an instruction's value is numbered, or
+ * returns 0 if it must not be numbered. The operands of commutative
+ * operations are put in a fixed order, and a > b is numbered as b < a.
+ */
+int make_key(ir_instr_t* in, expr_key_t* key) {
+	int op;
+	ir_operand_t a;
+	ir_operand_t b;
+	expr_key_t lhs;
+	expr_key_t rhs;
+
+	switch (in->op) {
+		case IR_RND:
+		case IR_IN:
+		case IR_CALL:
+			return 0;
+	}
+	if (in->a.kind == IR_VREG && num_defs[in->a.value] != 1) return 0;
+	if (in->b.kind == IR_VREG && num_defs[in->b.value] != 1) return 0;
+
+	op = in->op;
+	a = in->a;
+	b = in->b;
+	if (op == IR_GT || op == IR_GE) {
+		op = op == IR_GT ? IR_LT : IR_LE;
+		a = in->b;
+		b = in->a;
+	}
+
+	operand_key(a, &lhs);
+	operand_key(b, &rhs);
+	if ((op == IR_ADD || op == IR_AND || op == IR_EQ || op == IR_MUL
+		|| op == IR_NE || op == IR_OR) && rhs < lhs
+	) {
+		lhs.swap(rhs);
+	}
+
+	key->clear();
+	key->push_back(op);
+	key->push_back(func->vtype[in->dst]);
+	key->insert(key->end(), lhs.begin(), lhs.end());
+	key->insert(key->end(), rhs.begin(), rhs.end());
+	if (in->op == IR_ADDR || in->op == IR_LOAD) {
+		key->push_back(in->base);
+		key->push_back(in->disp);
+		key->push_back(in->is_elem);
+	}
+
+	return 1;
+}
+
+void operand_key(ir_operand_t op, expr_key_t* key) {
+	key->push_back(op.kind);
+	key->push_back(op.kind == IR_VREG ? vn[op.value] : op.value);
+
+	return;
+}
+
+void add_writes(writes_t* w, ir_instr_t* in) {
+	if (in->op == IR_CALL) {
+		w->call = 1;
+	} else if (in->op == IR_STORE && in->is_elem) {
+		w->elem = 1;
+	} else if (in->op == IR_STORE) {
+		w->slots.push_back(std::make_pair(in->base, in->disp));
+	}
+
+	return;
+}
+
+/* Forgets the loads of whatever may have been overwritten. Array elements
+ * are loaded through a register or marked as elements, and scalars are
+ * only ever loaded directly.
+ */
+void kill(writes_t* w) {
+	int base;
+	int disp;
+	int elem;
+	unsigned int i;
+	std::vector<expr_key_t> dead;
+	table_t::iterator entry;
+
+	if (!w->call && !w->elem && w->slots.empty()) return;
+
+	for (entry = table.begin(); entry != table.end(); entry++) {
+		if (entry->first[0] != IR_LOAD) continue;
+		base = entry->first[6];
+		disp = entry->first[7];
+		elem = entry->first[8];
+
+		if (w->call || (w->elem && elem)) {
+			dead.push_back(entry->first);
+			continue;
+		}
+		for (i = 0; i < w->slots.size() && !elem; i++) {
+			if (w->slots[i].first == base && w->slots[i].second == disp) {
+				dead.push_back(entry->first);
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < dead.size(); i++) {
+		undo.push_back(std::make_pair(dead[i], table[dead[i]]));
+		table.erase(dead[i]);
+	}
+
+	return;
+}
+
+/* Sets an entry of the table, remembering how to take it back */
+void set(expr_key_t* key, ir_operand_t value) {
+	table_t::iterator entry;
+	ir_operand_t none;
+
+	entry = table.find(*key);
+	if (entry == table.end()) {
+		none.kind = IR_NONE;
+		none.value = 0;
+		undo.push_back(std::make_pair(*key, none));
+	} else {
+		undo.push_back(*entry);
+	}
+	table[*key] = value;
+
+	return;
+}
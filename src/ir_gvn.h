@@ -0,0 +1,8 @@
+#ifndef _IR_GVN_H_
+#define _IR_GVN_H_
+
+#include "ir.h"
+
+void ir_gvn(ir_func_t* func);
+
+#endif /* _IR_GVN_H_ */
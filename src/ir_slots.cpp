@@ -0,0 +1,292 @@
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "emit.h"
+#include "ir.h"
+#include "ir_slots.h"
+#include "stats.h"
+
+/* Copy propagation and dead store elimination for the scalar locals and
+ * parameters of a function, which live in slots of its frame.
+ *
+ * Only a store to a slot itself can change it: there is no way to take the
+ * address of a scalar, a callee only writes its own frame, and an array
+ * passed by reference is reached through element operations, which never
+ * touch a scalar slot. The globals and statics are left alone, as any call
+ * may write them.
+ *
+ * A load of a slot that every path reaches with the same value last stored
+ * there is replaced by that value, so t = x; y = t + 1 adds 1 to x. A
+ * register assigned on several paths may have changed since it was stored,
+ * and a value is not carried across a call, where it would be spilled.
+ *
+ * A store is dead when no path from it reads the slot before storing it
+ * again or returning. The locals of an inlined body are dead once it ends,
+ * as they lie in the caller's frame and nothing else reads them.
+ */
+
+typedef std::map<int, ir_operand_t> known_t;
+
+/* What a block knows its slots hold on entry, unless no path reaches it
+ * yet
+ */
+typedef struct {
+	int top;
+	known_t known;
+} avail_t;
+
+static int is_slot(ir_instr_t* in);
+static void meet(avail_t* into, avail_t* from);
+static int same(known_t* a, known_t* b);
+static void transfer(ir_instr_t* in, known_t* known);
+static ir_operand_t resolve(ir_operand_t op);
+
+static ir_func_t* func;
+static std::vector<int> num_defs;
+static std::vector<ir_operand_t> repl;
+
+void ir_copyprop(ir_func_t* f) {
+	int changed;
+	int num_forwarded;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	ir_block_t* block;
+	ir_instr_t* in;
+	ir_operand_t none;
+	known_t::iterator value;
+	std::vector<avail_t> out;
+	avail_t avail;
+
+	func = f;
+	num_forwarded = 0;
+
+	none.kind = IR_NONE;
+	none.value = 0;
+	repl.assign(func->vtype.size(), none);
+	num_defs.assign(func->vtype.size(), 0);
+	for (i = 0; i < func->blocks.size(); i++) {
+		for (j = 0; j < func->blocks[i]->code.size(); j++) {
+			in = &func->blocks[i]->code[j];
+			if (in->dst >= 0) num_defs[in->dst]++;
+		}
+	}
+
+	avail.top = 1;
+	out.assign(func->blocks.size(), avail);
+	do {
+		changed = 0;
+		for (i = 0; i < func->blocks.size(); i++) {
+			block = func->blocks[i];
+			avail.top = i != 0;
+			avail.known.clear();
+			for (j = 0; j < block->pred.size(); j++) {
+				meet(&avail, &out[block->pred[j]->id]);
+			}
+			if (avail.top) continue;
+
+			for (j = 0; j < block->code.size(); j++) {
+				transfer(&block->code[j], &avail.known);
+			}
+			if (out[i].top || !same(&out[i].known, &avail.known)) {
+				out[i] = avail;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		avail.top = i != 0;
+		avail.known.clear();
+		for (j = 0; j < block->pred.size(); j++) {
+			meet(&avail, &out[block->pred[j]->id]);
+		}
+
+		for (j = 0; j < block->code.size(); j++) {
+			in = &block->code[j];
+			if (in->op == IR_LOAD && is_slot(in) && num_defs[in->dst] == 1) {
+				value = avail.known.find(in->disp);
+				if (value != avail.known.end()
+					&& (value->second.kind == IR_IMM
+						|| func->vtype[value->second.value]
+							== func->vtype[in->dst])
+				) {
+					repl[in->dst] = value->second;
+					num_forwarded++;
+				}
+			}
+			transfer(in, &avail.known);
+		}
+	}
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		for (j = 0; j < func->blocks[i]->code.size(); j++) {
+			in = &func->blocks[i]->code[j];
+			in->a = resolve(in->a);
+			in->b = resolve(in->b);
+			for (k = 0; k < in->args.size(); k++) {
+				in->args[k] = resolve(in->args[k]);
+			}
+		}
+	}
+
+	ir_sweep(func);
+
+	stats_count("copyprop", "loads forwarded", num_forwarded);
+
+	return;
+}
+
+/* Deletes the stores whose slots are not live after them. A slot is live
+ * where some path reads it before storing it again or returning.
+ */
+void ir_dse(ir_func_t* f) {
+	int changed;
+	int num_removed;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	ir_block_t* block;
+	ir_instr_t* in;
+	std::vector<std::set<int> > live_in;
+	std::set<int> live;
+	std::vector<ir_instr_t> code;
+
+	func = f;
+	num_removed = 0;
+
+	live_in.assign(func->blocks.size(), std::set<int>());
+	do {
+		changed = 0;
+		for (i = func->blocks.size(); i-- > 0;) {
+			block = func->blocks[i];
+			live.clear();
+			for (k = 0; k < block->succ.size(); k++) {
+				live.insert(live_in[block->succ[k]->id].begin(),
+					live_in[block->succ[k]->id].end());
+			}
+			for (j = block->code.size(); j-- > 0;) {
+				in = &block->code[j];
+				if (!is_slot(in)) continue;
+				if (in->op == IR_LOAD) {
+					live.insert(in->disp);
+				} else {
+					live.erase(in->disp);
+				}
+			}
+			if (live != live_in[i]) {
+				live_in[i] = live;
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	for (i = 0; i < func->blocks.size(); i++) {
+		block = func->blocks[i];
+		live.clear();
+		for (k = 0; k < block->succ.size(); k++) {
+			live.insert(live_in[block->succ[k]->id].begin(),
+				live_in[block->succ[k]->id].end());
+		}
+
+		code.clear();
+		for (j = block->code.size(); j-- > 0;) {
+			in = &block->code[j];
+			if (is_slot(in) && in->op == IR_LOAD) {
+				live.insert(in->disp);
+			} else if (is_slot(in)) {
+				if (!live.count(in->disp)) {
+					num_removed++;
+					continue;
+				}
+				live.erase(in->disp);
+			}
+			code.push_back(*in);
+		}
+		block->code.assign(code.rbegin(), code.rend());
+	}
+
+	ir_sweep(func);
+
+	stats_count("dse", "dead stores removed", num_removed);
+
+	return;
+}
+
+/* Checks whether an instruction loads or stores a scalar local or
+ * parameter
+ */
+int is_slot(ir_instr_t* in) {
+	return (in->op == IR_LOAD || in->op == IR_STORE)
+		&& in->a.kind == IR_NONE && in->base == FP && !in->is_elem;
+}
+
+/* Keeps what both sides know alike */
+void meet(avail_t* into, avail_t* from) {
+	known_t::iterator entry;
+	known_t::iterator other;
+
+	if (from->top) return;
+	if (into->top) {
+		*into = *from;
+		return;
+	}
+
+	for (entry = into->known.begin(); entry != into->known.end();) {
+		other = from->known.find(entry->first);
+		if (other == from->known.end()
+			|| other->second.kind != entry->second.kind
+			|| other->second.value != entry->second.value
+		) {
+			into->known.erase(entry++);
+		} else {
+			entry++;
+		}
+	}
+
+	return;
+}
+
+int same(known_t* a, known_t* b) {
+	known_t::iterator x;
+	known_t::iterator y;
+
+	if (a->size() != b->size()) return 0;
+
+	for (x = a->begin(), y = b->begin(); x != a->end(); x++, y++) {
+		if (x->first != y->first || x->second.kind != y->second.kind
+			|| x->second.value != y->second.value
+		) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+void transfer(ir_instr_t* in, known_t* known) {
+	if (in->op == IR_CALL) {
+		known->clear();
+	} else if (in->op == IR_STORE && is_slot(in)) {
+		if (in->b.kind == IR_IMM
+			|| (in->b.kind == IR_VREG && num_defs[in->b.value] == 1)
+		) {
+			(*known)[in->disp] = in->b;
+		} else {
+			known->erase(in->disp);
+		}
+	}
+
+	return;
+}
+
+ir_operand_t resolve(ir_operand_t op) {
+	while (op.kind == IR_VREG && repl[op.value].kind != IR_NONE) {
+		op = repl[op.value];
+	}
+
+	return op;
+}
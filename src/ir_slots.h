@@ -0,0 +1,9 @@
+#ifndef _IR_SLOTS_H_
+#define _IR_SLOTS_H_
+
+#include "ir.h"
+
+void ir_copyprop(ir_func_t* func);
+void ir_dse(ir_func_t* func);
+
+#endif /* _IR_SLOTS_H_ */
@@ -0,0 +1,147 @@
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+#include <vector>
+#include "ast.h"
+#include "licm.h"
+#include "stats.h"
+
+/* Loop-invariant code motion finds the expressions of a while loop that
+ * compute the same value on every iteration, so that codegen can evaluate
+ * them once before the loop and load the result inside it.
+ *
+ * An expression is invariant when nothing in the loop assigns the
+ * variables it reads. A call may assign any global or static, but never
+ * the locals of its caller. Hoisted code runs even when the loop runs zero
+ * times or leaves through a break, so only expressions that can neither
+ * have side effects nor trap are hoisted: no calls, assignments or ?, no
+ * array elements, and no division unless by a constant other than 0 and
+ * -1. Only whole operators are hoisted, as a single variable or constant
+ * costs no more to load than a temporary.
+ */
+
+typedef std::pair<int, int> slot_t;
+
+static void find_writes(ast_t* node);
+static void find_invariants(ast_t* node, std::vector<ast_t*>* found);
+static int is_invariant(ast_t* node);
+static slot_t var_slot(ast_t* var);
+
+static std::set<slot_t> writes;
+static int has_call;
+
+void licm_invariants(ast_t* loop, std::vector<ast_t*>* found) {
+	writes.clear();
+	has_call = 0;
+
+	find_writes(loop);
+	find_invariants(loop->child[0], found);
+	find_invariants(loop->child[1], found);
+
+	stats_count("licm", "expressions hoisted", found->size());
+
+	return;
+}
+
+/* Collects the variables assigned in a loop. A local declared in the loop
+ * is assigned by its initializer.
+ */
+void find_writes(ast_t* node) {
+	int i;
+
+	for (; node; node = node->sibling) {
+		switch (node->type) {
+			case NODE_ASSIGN:
+				if (node->child[0]->type == NODE_ID) {
+					writes.insert(var_slot(node->child[0]));
+				}
+				break;
+			case NODE_CALL:
+				has_call = 1;
+				break;
+			case NODE_VAR:
+				writes.insert(var_slot(node));
+				break;
+		}
+
+		for (i = 0; i < node->num_children; i++) {
+			find_writes(node->child[i]);
+		}
+	}
+
+	return;
+}
+
+/* Collects the largest invariant operators in a subtree */
+void find_invariants(ast_t* node, std::vector<ast_t*>* found) {
+	int i;
+
+	for (; node; node = node->sibling) {
+		if (node->type == NODE_OP && is_invariant(node)
+			&& !(node->data.op == OP_SIZE
+				&& node->child[0]->data.mem.scope != SCOPE_PARAM)
+		) {
+			found->push_back(node);
+			continue;
+		}
+
+		for (i = 0; i < node->num_children; i++) {
+			find_invariants(node->child[i], found);
+		}
+	}
+
+	return;
+}
+
+int is_invariant(ast_t* node) {
+	int i;
+	int divisor;
+
+	switch (node->type) {
+		case NODE_CONST:
+			return 1;
+		case NODE_ID:
+			/* neither array addresses nor sizes ever change */
+			if (node->data.is_array) return 1;
+			if (writes.count(var_slot(node))) return 0;
+			return node->data.mem.scope == SCOPE_LOCAL
+				|| node->data.mem.scope == SCOPE_PARAM || !has_call;
+		case NODE_OP:
+			break;
+		default:
+			return 0;
+	}
+
+	switch (node->data.op) {
+		case OP_QMARK:
+		case OP_SUBSC:
+			return 0;
+		case OP_SIZE:
+			return 1;
+		case OP_DIV:
+		case OP_MOD:
+			if (node->child[1]->type != NODE_CONST) return 0;
+			divisor = ast_const_value(node->child[1]);
+			if (divisor == 0 || divisor == -1) return 0;
+			break;
+	}
+
+	for (i = 0; i < node->num_children; i++) {
+		if (node->child[i] && !is_invariant(node->child[i])) return 0;
+	}
+
+	return 1;
+}
+
+/* Names the memory of a variable by its base register and offset, since
+ * variables in different scopes may share a name or reuse a location.
+ */
+slot_t var_slot(ast_t* var) {
+	int frame;
+
+	frame = var->data.mem.scope == SCOPE_LOCAL
+		|| var->data.mem.scope == SCOPE_PARAM;
+
+	return slot_t(frame, var->data.mem.loc);
+}
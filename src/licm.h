@@ -0,0 +1,9 @@
+#ifndef _LICM_H_
+#define _LICM_H_
+
+#include <vector>
+#include "ast.h"
+
+void licm_invariants(ast_t* loop, std::vector<ast_t*>* found);
+
+#endif /* _LICM_H_ */
@@ -1,23 +1,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "alloc.h"
 #include "ast.h"
+#include "cache.h"
 #include "codegen.h"
 #include "flags.h"
 #include "getopt.h"
+#include "passes.h"
+#include "perf.h"
+#include "phase.h"
 #include "print_tree.h"
 #include "semantic.h"
+#include "stats.h"
 #include "symtab.h"
+#include "trace.h"
 #include "yyerror.h"
 
 #define FALSE 0
 #define TRUE 1
 #define FNAME_LEN 100
+#define CACHE_MAX_MB 64
 
 extern void scanner_use_file(char* fname);
 extern int yyparse(void);
 
 extern int yydebug;
+extern char* optarg;
 extern int optind;
 extern ast_t* syntax_tree;
 extern SymbolTable sem_symtab;
@@ -30,43 +39,153 @@ flags_t flags;
 static char* finput;
 static char* fname;
 static FILE* fout;
+static char* cache_dir;
+static long cache_max;
+static int cache_stats;
+static char* trace_fname;
+
+static long parse_size(char* str);
 
 int main(int argc, char** argv) {
 	int end;
+	int found;
+	int i;
+	int level;
+	int nfiles;
 	char c;
+	char** files;
+	ast_t* program;
 
 	/* Set default values */
+	flags.alloc_profile = 0;
+	flags.cache = 0;
+	flags.perf = 0;
+	flags.stats = 0;
 	flags.yydebug = 0;
 	flags.symtab_debug = 0;
 	flags.print_ast = 0;
 	flags.print_aug_ast = 0;
+	flags.emit_ir = 0;
+	flags.time_passes = 0;
+	level = OPT_LEVEL_MAX;
 	finput = (char*) "";
+	fname = NULL;
+	cache_dir = NULL;
+	cache_max = CACHE_MAX_MB * 1024L * 1024L;
+	cache_stats = 0;
+	trace_fname = NULL;
 	errors = 0;
 	offset = 0;
 	warnings = 0;
 
 	initErrorProcessing();
 
-	/* Read command line options */
-	while ((c = getopt(argc, argv, (char*) "dDhpP")) != -1) {
+	/* Read command line options. Options may appear before, between or
+	 * after the source files, which are collected in command line order.
+	 */
+	files = (char**) malloc(sizeof(char*) * argc);
+	nfiles = 0;
+	while (optind < argc) {
+		if ((c = getopt(argc, argv, (char*) "-:dDf:hO:o:pP")) == -1) {
+			if (optind < argc) files[nfiles++] = argv[optind++];
+			continue;
+		}
+
 		switch (c) {
+			case '-':
+				if (!strcmp(optarg, "alloc-profile")) {
+					flags.alloc_profile = 1;
+				} else if (!strcmp(optarg, "cache")) {
+					flags.cache = 1;
+				} else if (!strncmp(optarg, "cache-dir=", 10)) {
+					flags.cache = 1;
+					cache_dir = optarg + 10;
+				} else if (!strncmp(optarg, "cache-max=", 10)) {
+					cache_max = parse_size(optarg + 10);
+				} else if (!strcmp(optarg, "cache-stats")) {
+					cache_stats = 1;
+				} else if (!strcmp(optarg, "emit-ir")) {
+					flags.emit_ir = 1;
+				} else if (!strcmp(optarg, "perf")) {
+					flags.perf = 1;
+				} else if (!strcmp(optarg, "stats")) {
+					flags.stats = 1;
+				} else if (!strcmp(optarg, "time-passes")) {
+					flags.time_passes = 1;
+				} else if (!strncmp(optarg, "trace=", 6)) {
+					trace_fname = optarg + 6;
+				} else {
+					fprintf(stderr, "%s: illegal option -- -%s\n", argv[0],
+						optarg);
+				}
+				break;
 			case 'd':
 				flags.yydebug = 1;
 				break;
 			case 'D':
 				flags.symtab_debug = 1;
 				break;
+			case 'f':
+				if (!strncmp(optarg, "no-", 3)) {
+					found = passes_force(optarg + 3, 0);
+				} else {
+					found = passes_force(optarg, 1);
+				}
+				if (!found) {
+					fprintf(stderr, "%s: unknown pass -- %s\n", argv[0],
+						optarg);
+				}
+				break;
 			case 'h':
-				fprintf(stdout, "Usage: %s [options] [file]\n\n", argv[0]);
+				fprintf(stdout, "Usage: %s [options] [file ...]\n\n", argv[0]);
 				fprintf(stdout, "Options:\n");
 				fprintf(stdout, "  -d\tEnable parser debugging traces\n");
 				fprintf(stdout, "  -D\tEnable symbol table debugging traces\n");
+				fprintf(stdout, "  -fPASS, -fno-PASS\n\tRun or skip a pass whatever ");
+				fprintf(stdout, "the optimization level\n");
 				fprintf(stdout, "  -h\tPrint this help information and exit\n");
+				fprintf(stdout, "  -O LEVEL\n\tOptimize at LEVEL 0, 1 or 2 ");
+				fprintf(stdout, "(default %i)\n", OPT_LEVEL_MAX);
+				fprintf(stdout, "  -o\tWrite generated code to the given file\n");
 				fprintf(stdout, "  -p\tPrint syntax tree before semantic analysis\n");
-				fprintf(stdout, "  -P\tPrint syntax tree after semantic analysis\n\n");
+				fprintf(stdout, "  -P\tPrint syntax tree after semantic analysis\n");
+				fprintf(stdout, "  --alloc-profile\n\tReport allocations and leaks ");
+				fprintf(stdout, "by phase and call site\n");
+				fprintf(stdout, "  --cache\n\tReuse the results of identical earlier compiles\n");
+				fprintf(stdout, "  --cache-dir=DIR\n\tKeep the compile cache in DIR ");
+				fprintf(stdout, "(default $CMINUS_CACHE_DIR or ~/.cache/c-)\n");
+				fprintf(stdout, "  --cache-max=SIZE\n\tLimit the compile cache to SIZE bytes, ");
+				fprintf(stdout, "with an optional K, M or G suffix (default %iM)\n",
+					CACHE_MAX_MB);
+				fprintf(stdout, "  --cache-stats\n\tPrint compile cache statistics and exit\n");
+				fprintf(stdout, "  --emit-ir\n\tPrint the intermediate code of each ");
+				fprintf(stdout, "function\n");
+				fprintf(stdout, "  --perf\n\tReport hardware performance counters ");
+				fprintf(stdout, "for each phase\n");
+				fprintf(stdout, "  --stats\n\tReport what the optimizations did\n");
+				fprintf(stdout, "  --time-passes\n\tReport the time taken by ");
+				fprintf(stdout, "each pass\n");
+				fprintf(stdout, "  --trace=FILE\n\tWrite a timeline of the phases and ");
+				fprintf(stdout, "functions to FILE in Chrome trace format\n\n");
 				fprintf(stdout, "If [file] is omitted then input is read from stdin.\n");
+				fprintf(stdout, "Multiple files are compiled together as one program.\n\n");
+				fprintf(stdout, "Passes, with the lowest level that runs them:\n");
+				passes_list(stdout);
 				exit(0);
 				break;
+			case 'O':
+				if (optarg[0] < '0' || optarg[0] > '0' + OPT_LEVEL_MAX
+					|| optarg[1] != '\0'
+				) {
+					fprintf(stderr, "%s: illegal optimization level -- %s\n",
+						argv[0], optarg);
+				} else {
+					level = optarg[0] - '0';
+				}
+				break;
+			case 'o':
+				fname = optarg;
+				break;
 			case 'p':
 				flags.print_ast = 1;
 				break;
@@ -76,34 +195,19 @@ int main(int argc, char** argv) {
 		}
 	}
 
-	/* Find input source */
-	switch (argc - optind) {
-		case 1:
-			finput = argv[optind];
-			scanner_use_file(finput);
-			break;
-		case 0:
-			/* read from STDIN */
-			break;
+	if (cache_stats) {
+		cache_init(cache_dir, cache_max);
+		cache_print_stats();
+		exit(0);
 	}
 
-	if (flags.yydebug) yydebug = 1;
-	if (flags.symtab_debug) sem_symtab.debug(true);
-
-	yyparse();
-
-	if (flags.print_ast) ast_print(syntax_tree, FALSE);
-	if (errors) goto end;
-
-	syntax_tree = sem_analysis(syntax_tree);
-
-	if (flags.print_aug_ast) {
-		ast_print(syntax_tree, TRUE);
-		fprintf(stdout, "Offset for end of global space: %i\n", offset);
+	/* Name the output after the first source file */
+	if (nfiles > 0) {
+		/* copy, since the output name is cut out of it in place */
+		finput = strdup(files[0]);
 	}
-	if (errors) goto end;
 
-	if (strcmp(finput, "")) {
+	if (fname == NULL && strcmp(finput, "")) {
 		for (end = strlen(finput); end >= 0; end--) {
 			if (finput[end] == '.') break;
 		}
@@ -116,21 +220,121 @@ int main(int argc, char** argv) {
 
 		fname = (char*) malloc(sizeof(char) * FNAME_LEN);
 		sprintf(fname, "%s.tm", finput);
-	} else {
+	} else if (fname == NULL) {
 		fname = (char*) "out.tm";
 	}
+
+	passes_configure(level);
+
+	if (flags.yydebug) yydebug = 1;
+	if (flags.symtab_debug) sem_symtab.debug(true);
+	if (flags.alloc_profile) alloc_profile_enable();
+	if (flags.perf) perf_enable();
+	if (flags.stats) stats_enable();
+	if (trace_fname && !trace_open(trace_fname)) {
+		fprintf(stderr, "WARNING: trace file \"%s\" could not be opened.\n",
+			trace_fname);
+	}
+
+	/* The parser traces go to stderr, which the cache does not keep, and a
+	 * profile, a trace, statistics or pass timings are only meaningful for
+	 * a real compile.
+	 */
+	if (flags.cache && !flags.yydebug && !flags.alloc_profile && !flags.perf
+		&& !flags.stats && !flags.time_passes && !trace_enabled()
+	) {
+		cache_init(cache_dir, cache_max);
+		if (cache_fetch(files, nfiles, fname)) exit(0);
+	}
+
+	/* Parse each input source in command line order. Record type names are
+	 * kept in a single table, so a record declared in an earlier file is a
+	 * type name in every later one. The top level declarations of all the
+	 * files are joined into a single program.
+	 */
+	phase_begin(PHASE_PARSE);
+	program = NULL;
+
+	if (nfiles == 0) {
+		/* read from STDIN */
+		yyparse();
+		program = syntax_tree;
+	}
+
+	for (i = 0; i < nfiles; i++) {
+		if (nfiles > 1) ast_filename = files[i];
+		scanner_use_file(files[i]);
+		syntax_tree = NULL;
+		yyparse();
+
+		if (program == NULL) {
+			program = syntax_tree;
+		} else {
+			ast_add_sibling(program, syntax_tree);
+		}
+	}
+
+	syntax_tree = program;
+	phase_end();
+
+	if (flags.print_ast) ast_print(syntax_tree, FALSE);
+	if (errors) goto end;
+
+	phase_begin(PHASE_SEMANTIC);
+	syntax_tree = sem_analysis(syntax_tree);
+	phase_end();
+
+	if (flags.print_aug_ast) {
+		ast_print(syntax_tree, TRUE);
+		fprintf(stdout, "Offset for end of global space: %i\n", offset);
+	}
+	if (errors) goto end;
+
+	phase_begin(PHASE_OPTIMIZE);
+	syntax_tree = passes_run_ast(syntax_tree);
+	phase_end();
+
 	fout = fopen(fname, "w");
 	if (fout == NULL) {
 		fprintf(stdout, "ERROR(OUTPUT): output file \"%s\" ", fname);
 		fprintf(stdout, "could not be opened.\n");
+		/* not a property of the sources, so keep it out of the cache */
+		flags.cache = 0;
 		goto end;
 	}
+	phase_begin(PHASE_CODEGEN);
 	codegen(syntax_tree, fout);
+	phase_end();
 	fclose(fout);
 
 	end:
 	fprintf(stdout, "Number of warnings: %i\n", warnings);
 	fprintf(stdout, "Number of errors: %i\n", errors);
 
+	if (flags.cache) cache_store(fout ? fname : NULL);
+
 	exit(0);
 }
+
+long parse_size(char* str) {
+	long size;
+	char* unit;
+
+	size = strtol(str, &unit, 10);
+
+	switch (*unit) {
+		case 'G':
+		case 'g':
+			size *= 1024L;
+			/* fall through */
+		case 'M':
+		case 'm':
+			size *= 1024L;
+			/* fall through */
+		case 'K':
+		case 'k':
+			size *= 1024L;
+	}
+
+	return size;
+}
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "dce.h"
+#include "flags.h"
+#include "fold.h"
+#include "inline.h"
+#include "ir_gvn.h"
+#include "ir_slots.h"
+#include "passes.h"
+#include "peephole.h"
+#include "trace.h"
+#include "unroll.h"
+
+/* Every optimization is named here along with the flag that enables it and
+ * the lowest optimization level it belongs to. At -O0 none of them run, so
+ * the code is generated straight from the syntax tree as it was parsed.
+ *
+ * A pass rewrites the syntax tree, the IR of each function or the final
+ * instructions, and runs from here in the order of this table. The other
+ * entries are choices made while generating code, which only need their
+ * flag set. A new pass is registered by adding it to the table.
+ */
+
+typedef struct {
+	const char* name;
+	pass_kind_t kind;
+	int level;
+	int* flag;
+	ast_t* (*run_ast)(ast_t* tree);
+	void (*run_ir)(ir_func_t* func);
+	void (*run_instr)(instr_t* code, int count);
+} pass_t;
+
+extern flags_t flags;
+
+static long now();
+static void report();
+
+static pass_t passes[] = {
+	{"fold", PASS_AST, 1, &flags.fold, fold_constants, NULL, NULL},
+	{"unroll", PASS_AST, 2, &flags.unroll, unroll_loops, NULL, NULL},
+	{"inlining", PASS_AST, 2, &flags.inlining, inline_calls, NULL, NULL},
+	{"dce", PASS_AST, 1, &flags.dce, dce_eliminate, NULL, NULL},
+	{"ir", PASS_CODEGEN, 2, &flags.ir, NULL, NULL, NULL},
+	{"copyprop", PASS_IR, 2, &flags.copyprop, NULL, ir_copyprop, NULL},
+	{"gvn", PASS_IR, 2, &flags.gvn, NULL, ir_gvn, NULL},
+	{"dse", PASS_IR, 2, &flags.dse, NULL, ir_dse, NULL},
+	{"addressing", PASS_CODEGEN, 1, &flags.addressing, NULL, NULL, NULL},
+	{"data-image", PASS_CODEGEN, 1, &flags.data_image, NULL, NULL, NULL},
+	{"fused-branch", PASS_CODEGEN, 1, &flags.fused_branch, NULL, NULL,
+		NULL},
+	{"leaf", PASS_CODEGEN, 1, &flags.leaf, NULL, NULL, NULL},
+	{"licm", PASS_CODEGEN, 2, &flags.licm, NULL, NULL, NULL},
+	{"regalloc", PASS_CODEGEN, 1, &flags.regalloc, NULL, NULL, NULL},
+	{"rmw", PASS_CODEGEN, 1, &flags.rmw, NULL, NULL, NULL},
+	{"short-circuit", PASS_CODEGEN, 1, &flags.short_circuit, NULL, NULL,
+		NULL},
+	{"strength", PASS_CODEGEN, 1, &flags.strength, NULL, NULL, NULL},
+	{"tail-calls", PASS_CODEGEN, 2, &flags.tail_calls, NULL, NULL, NULL},
+	{"peephole", PASS_INSTR, 1, &flags.peephole, NULL, NULL, peephole},
+	{"threading", PASS_INSTR, 1, &flags.threading, NULL, NULL,
+		thread_jumps},
+};
+
+#define NUM_PASSES (int) (sizeof(passes) / sizeof(passes[0]))
+
+/* 1 or -1 where -f or -fno- forced a pass on or off whatever the level */
+static int forced[NUM_PASSES];
+
+/* For --time-passes */
+static int runs[NUM_PASSES];
+static long usec[NUM_PASSES];
+
+/* Sets the flag of every pass from the optimization level, unless it was
+ * forced on or off
+ */
+void passes_configure(int level) {
+	int i;
+
+	for (i = 0; i < NUM_PASSES; i++) {
+		if (forced[i]) {
+			*passes[i].flag = forced[i] > 0;
+		} else {
+			*passes[i].flag = level >= passes[i].level;
+		}
+	}
+
+	if (flags.time_passes) atexit(report);
+
+	return;
+}
+
+/* Forces a pass on or off whatever the optimization level. Returns 0 if
+ * there is no such pass.
+ */
+int passes_force(const char* name, int on) {
+	int i;
+
+	for (i = 0; i < NUM_PASSES; i++) {
+		if (!strcmp(passes[i].name, name)) {
+			forced[i] = on ? 1 : -1;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+void passes_list(FILE* out) {
+	int i;
+
+	for (i = 0; i < NUM_PASSES; i++) {
+		fprintf(out, "\t%-14s -O%i  ", passes[i].name, passes[i].level);
+		switch (passes[i].kind) {
+			case PASS_AST:
+				fprintf(out, "syntax tree\n");
+				break;
+			case PASS_IR:
+				fprintf(out, "IR\n");
+				break;
+			case PASS_INSTR:
+				fprintf(out, "instructions\n");
+				break;
+			case PASS_CODEGEN:
+				fprintf(out, "code generation\n");
+				break;
+		}
+	}
+
+	return;
+}
+
+/* Checks whether any pass of a kind will run */
+int passes_enabled(pass_kind_t kind) {
+	int i;
+
+	for (i = 0; i < NUM_PASSES; i++) {
+		if (passes[i].kind == kind && *passes[i].flag) return 1;
+	}
+
+	return 0;
+}
+
+ast_t* passes_run_ast(ast_t* tree) {
+	int i;
+	long start;
+
+	for (i = 0; i < NUM_PASSES; i++) {
+		if (passes[i].kind != PASS_AST || !*passes[i].flag) continue;
+
+		start = now();
+		trace_begin("pass", passes[i].name);
+		tree = passes[i].run_ast(tree);
+		trace_end("pass", passes[i].name, 0);
+		usec[i] += now() - start;
+		runs[i]++;
+	}
+
+	return tree;
+}
+
+/* Runs the IR passes over a function, checking that each one left the IR
+ * well formed
+ */
+void passes_run_ir(ir_func_t* func) {
+	int i;
+	long start;
+
+	for (i = 0; i < NUM_PASSES; i++) {
+		if (passes[i].kind != PASS_IR || !*passes[i].flag) continue;
+
+		start = now();
+		trace_begin(passes[i].name, func->name);
+		passes[i].run_ir(func);
+		ir_verify(func, passes[i].name);
+		trace_end(passes[i].name, func->name, 0);
+		usec[i] += now() - start;
+		runs[i]++;
+	}
+
+	return;
+}
+
+void passes_run_instr(instr_t* code, int count) {
+	int i;
+	long start;
+
+	for (i = 0; i < NUM_PASSES; i++) {
+		if (passes[i].kind != PASS_INSTR || !*passes[i].flag) continue;
+
+		start = now();
+		trace_begin("pass", passes[i].name);
+		passes[i].run_instr(code, count);
+		trace_end("pass", passes[i].name, 0);
+		usec[i] += now() - start;
+		runs[i]++;
+	}
+
+	return;
+}
+
+long now() {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+/* Prints the time taken by each pass that ran, in the order they ran in */
+void report() {
+	int i;
+	long total;
+
+	total = 0;
+	for (i = 0; i < NUM_PASSES; i++) total += usec[i];
+
+	fprintf(stderr, "\n===========  Pass Execution Times  =========\n");
+
+	for (i = 0; i < NUM_PASSES; i++) {
+		if (runs[i] == 0) continue;
+		fprintf(stderr, "%-14s %6i runs %10li us %6.1f%%\n", passes[i].name,
+			runs[i], usec[i], total ? 100.0 * usec[i] / total : 0.0);
+	}
+
+	fprintf(stderr, "%-14s %16s %10li us\n", "total", "", total);
+	fprintf(stderr, "===========  ==================  ===========\n");
+
+	return;
+}
@@ -0,0 +1,26 @@
+#ifndef _PASSES_H_
+#define _PASSES_H_
+
+#include <stdio.h>
+#include "ast.h"
+#include "emit.h"
+#include "ir.h"
+
+#define OPT_LEVEL_MAX 2
+
+typedef enum {
+	PASS_AST,
+	PASS_IR,
+	PASS_INSTR,
+	PASS_CODEGEN,
+} pass_kind_t;
+
+void passes_configure(int level);
+int passes_force(const char* name, int on);
+void passes_list(FILE* out);
+int passes_enabled(pass_kind_t kind);
+ast_t* passes_run_ast(ast_t* tree);
+void passes_run_ir(ir_func_t* func);
+void passes_run_instr(instr_t* code, int count);
+
+#endif /* _PASSES_H_ */
@@ -0,0 +1,491 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emit.h"
+#include "peephole.h"
+#include "stats.h"
+
+/* The peephole optimizer deletes instructions from the buffered code. Each
+ * rule matches a window of consecutive instructions against patterns such
+ * as "ST %r,%k(%b)", where %x binds an operand and the same variable must
+ * bind the same value throughout the window. Variables in register
+ * positions never bind the PC. A rule may also have a check that looks
+ * further ahead, and it names the instruction in the window it deletes.
+ *
+ * An instruction that is the target of a jump can be reached without the
+ * instructions before it, so only the first instruction of a window may be
+ * a target. Deleted instructions are never moved, so a jump to one simply
+ * lands on the next instruction kept when the code is written out. Rules
+ * are applied until none of them matches.
+ */
+
+#define WINDOW 2
+#define SCAN 16
+
+typedef struct {
+	const char* name;
+	const char* pattern[WINDOW];
+	const char* distinct;
+	int (*check)(int at);
+	int remove;
+} rule_t;
+
+static int match(rule_t* rule, int at, int* window);
+static int match_instr(const char* pattern, instr_t* in, int* vars, int* set);
+static int match_operand(const char** pattern, int value, int is_reg,
+	int* vars, int* set);
+static int next(int at);
+static int resolve(int addr);
+static void find_targets();
+static int is_jump(instr_t* in);
+static int reads(instr_t* in, int reg);
+static int writes(instr_t* in);
+static int jump_to_next(int at);
+static int dead_write(int at);
+static int dead_store(int at);
+static int is_goto(instr_t* in);
+static int thread(int at);
+static int invert(int at);
+static int remove_unreachable();
+
+static rule_t rules[] = {
+	/* the register still holds the value that was just stored */
+	{ "store-load", { "ST %r,%k(%b)", "LD %r,%k(%b)" }, "", NULL, 1 },
+	/* the memory still holds the value that was just loaded */
+	{ "load-store", { "LD %r,%k(%b)", "ST %r,%k(%b)" }, "rb", NULL, 1 },
+	/* copying a register back to the one it was copied from */
+	{ "move-back", { "LDA %a,0(%b)", "LDA %b,0(%a)" }, "", NULL, 1 },
+	{ "self-move", { "LDA %r,0(%r)", NULL }, "", NULL, 0 },
+	{ "jump-to-next", { NULL, NULL }, "", jump_to_next, 0 },
+	/* a register overwritten before it is read, like an unused result */
+	{ "dead-write", { NULL, NULL }, "", dead_write, 0 },
+	/* a frame slot overwritten or released before it is read */
+	{ "dead-store", { "ST %r,%k(FP)", NULL }, "", dead_store, 0 },
+};
+
+static instr_t* code;
+static int count;
+static int* is_target;
+
+void peephole(instr_t* instrs, int num_instrs) {
+	int i;
+	int r;
+	int changed;
+	int num_rules;
+	int window[WINDOW];
+	int* hits;
+
+	code = instrs;
+	count = num_instrs;
+	num_rules = sizeof(rules) / sizeof(rule_t);
+	is_target = (int*) malloc(sizeof(int) * (count + 1));
+	hits = (int*) calloc(num_rules, sizeof(int));
+
+	do {
+		changed = 0;
+		find_targets();
+
+		for (i = next(-1); i < count; i = next(i)) {
+			for (r = 0; r < num_rules; r++) {
+				if (!match(&rules[r], i, window)) continue;
+				code[window[rules[r].remove]].deleted = 1;
+				hits[r]++;
+				changed = 1;
+				break;
+			}
+		}
+	} while (changed);
+
+	for (r = 0; r < num_rules; r++) {
+		stats_count("peephole", rules[r].name, hits[r]);
+	}
+
+	free(is_target);
+	free(hits);
+
+	return;
+}
+
+int match(rule_t* rule, int at, int* window) {
+	int i;
+	int vars[26];
+	int set[26];
+	const char* v;
+
+	memset(set, 0, sizeof(set));
+
+	for (i = 0; i < WINDOW; i++) {
+		window[i] = i ? next(window[i - 1]) : at;
+		if (rule->pattern[i] == NULL) break;
+		if (window[i] >= count) return 0;
+		if (i && is_target[window[i]]) return 0;
+		if (!match_instr(rule->pattern[i], &code[window[i]], vars, set)) {
+			return 0;
+		}
+	}
+
+	for (v = rule->distinct; v[0] && v[1]; v += 2) {
+		if (vars[v[0] - 'a'] == vars[v[1] - 'a']) return 0;
+	}
+
+	if (rule->check && !rule->check(at)) return 0;
+
+	return 1;
+}
+
+/* Patterns are "OP r,d(s)" for register to memory instructions and
+ * "OP r,s,t" for register only ones.
+ */
+int match_instr(const char* pattern, instr_t* in, int* vars, int* set) {
+	int len;
+	int is_rm;
+
+	len = strcspn(pattern, " ");
+	if (strncmp(pattern, in->op, len) || in->op[len] != '\0') return 0;
+
+	is_rm = strchr(pattern, '(') != NULL;
+	if (is_rm != (in->kind == INSTR_RM)) return 0;
+
+	pattern += len + 1;
+	if (!match_operand(&pattern, in->r, 1, vars, set)) return 0;
+	if (is_rm) {
+		if (!match_operand(&pattern, in->d, 0, vars, set)) return 0;
+		if (!match_operand(&pattern, in->s, 1, vars, set)) return 0;
+	} else {
+		if (!match_operand(&pattern, in->s, 1, vars, set)) return 0;
+		if (!match_operand(&pattern, in->t, 1, vars, set)) return 0;
+	}
+
+	return 1;
+}
+
+int match_operand(const char** pattern, int value, int is_reg, int* vars,
+	int* set
+) {
+	int i;
+	int expect;
+	const char* p;
+	static const char* regs[] = {
+		"GP", "FP", "RT", "AC", "AC1", "AC2", "AC3", "PC", NULL
+	};
+
+	p = *pattern;
+	*pattern += strcspn(p, ",()") + 1;
+
+	if (p[0] == '%') {
+		i = p[1] - 'a';
+		if (is_reg && value == PC) return 0;
+		if (set[i]) return vars[i] == value;
+		vars[i] = value;
+		set[i] = 1;
+		return 1;
+	}
+
+	if (isdigit(p[0]) || p[0] == '-') return atoi(p) == value;
+
+	expect = -1;
+	for (i = 0; regs[i]; i++) {
+		if (!strncmp(p, regs[i], strlen(regs[i]))
+			&& !isalnum(p[strlen(regs[i])])
+		) {
+			expect = i;
+		}
+	}
+
+	return expect == value;
+}
+
+/* Returns the next instruction after at that has not been deleted */
+int next(int at) {
+	for (at++; at < count; at++) {
+		if (code[at].kind != INSTR_NONE && !code[at].deleted) break;
+	}
+
+	return at;
+}
+
+int resolve(int addr) {
+	return addr < count ? next(addr - 1) : count;
+}
+
+void find_targets() {
+	int i;
+
+	memset(is_target, 0, sizeof(int) * (count + 1));
+
+	for (i = 0; i < count; i++) {
+		if (code[i].kind != INSTR_RM || code[i].deleted) continue;
+		if (code[i].target >= 0) is_target[resolve(code[i].target)] = 1;
+	}
+
+	return;
+}
+
+int is_jump(instr_t* in) {
+	if (in->kind == INSTR_RO) return !strcmp(in->op, "HALT");
+
+	return in->r == PC || in->op[0] == 'J';
+}
+
+int reads(instr_t* in, int reg) {
+	if (in->kind == INSTR_RM) {
+		if (!strcmp(in->op, "LDC")) return 0;
+		if (!strcmp(in->op, "LD") || !strcmp(in->op, "LDA")) {
+			return in->s == reg;
+		}
+		return in->r == reg || in->s == reg;
+	}
+
+	if (!strncmp(in->op, "IN", 2) || !strcmp(in->op, "OUTNL")
+		|| !strcmp(in->op, "HALT")
+	) {
+		return 0;
+	}
+	if (!strncmp(in->op, "OUT", 3)) return in->r == reg;
+
+	return in->s == reg || in->t == reg;
+}
+
+/* Returns the register an instruction writes, or -1 */
+int writes(instr_t* in) {
+	if (in->kind == INSTR_RM) {
+		if (!strcmp(in->op, "ST") || in->op[0] == 'J') return -1;
+		return in->r;
+	}
+
+	if (!strncmp(in->op, "OUT", 3) || !strcmp(in->op, "HALT")) return -1;
+
+	return in->r;
+}
+
+int jump_to_next(int at) {
+	if (code[at].kind != INSTR_RM || code[at].target < 0) return 0;
+	if (!is_jump(&code[at])) return 0;
+
+	return resolve(code[at].target) == next(at);
+}
+
+/* Only instructions without side effects are removed, which leaves out
+ * input, RND and DIV, which can trap.
+ */
+int dead_write(int at) {
+	int i;
+	int n;
+	int reg;
+	const char* op;
+	static const char* pure[] = {
+		"LD", "LDA", "LDC", "ADD", "SUB", "MUL", "AND", "OR",
+		"TLT", "TLE", "TGT", "TGE", "TEQ", "TNE", NULL
+	};
+
+	op = code[at].op;
+	for (i = 0; pure[i] && strcmp(pure[i], op); i++);
+	if (pure[i] == NULL) return 0;
+
+	reg = code[at].r;
+	if (reg == PC || code[at].target >= 0) return 0;
+
+	for (n = 0, at = next(at); at < count && n < SCAN; n++, at = next(at)) {
+		if (reads(&code[at], reg) || is_jump(&code[at])) return 0;
+		if (writes(&code[at]) == reg) return 1;
+	}
+
+	return 0;
+}
+
+/* Frame slots can only be read through the FP, the GP never points into
+ * the stack, and any other base register may point anywhere. Returning
+ * from the function releases the frame.
+ */
+int dead_store(int at) {
+	int n;
+	int slot;
+	instr_t* in;
+
+	slot = code[at].d;
+
+	for (n = 0, at = next(at); at < count && n < SCAN; n++, at = next(at)) {
+		in = &code[at];
+		if (in->kind == INSTR_RM && !strcmp(in->op, "LD")) {
+			if (in->s == FP && in->d == slot) return 0;
+			if (in->s != FP && in->s != GP) return 0;
+			if (in->r == FP && in->s == FP && in->d == 0) return 1;
+		}
+		if (in->kind == INSTR_RM && !strcmp(in->op, "ST")) {
+			if (in->s == FP && in->d == slot) return 1;
+		}
+		if (writes(in) == FP || is_jump(in)) return 0;
+	}
+
+	return 0;
+}
+
+/* Jump threading sends every jump whose target is an unconditional jump
+ * straight to where the chain of jumps ends, such as a jump around an
+ * else that lands on the jump back to the top of a loop. A conditional
+ * jump over an unconditional one, as in if (c) break, becomes a single
+ * jump on the opposite condition. A jump to the next instruction is
+ * deleted, as is code that no jump or fall through can reach from the
+ * start, like the jumps left behind a break. Every return address is
+ * loaded PC relative, so the instructions that calls return to are
+ * targets as well.
+ */
+void thread_jumps(instr_t* instrs, int num_instrs) {
+	int i;
+	int changed;
+	int num_threaded;
+	int num_inverted;
+	int num_next;
+	int num_unreachable;
+
+	code = instrs;
+	count = num_instrs;
+	is_target = (int*) malloc(sizeof(int) * (count + 1));
+	num_threaded = 0;
+	num_inverted = 0;
+	num_next = 0;
+	num_unreachable = 0;
+
+	do {
+		changed = 0;
+		find_targets();
+
+		for (i = next(-1); i < count; i = next(i)) {
+			if (code[i].kind != INSTR_RM || code[i].target < 0) continue;
+			if (!is_jump(&code[i])) continue;
+			if (thread(i)) {
+				num_threaded++;
+				changed = 1;
+			}
+			if (invert(i)) {
+				num_inverted++;
+				changed = 1;
+			}
+			if (jump_to_next(i)) {
+				code[i].deleted = 1;
+				num_next++;
+				changed = 1;
+			}
+		}
+
+		i = remove_unreachable();
+		num_unreachable += i;
+		if (i) changed = 1;
+	} while (changed);
+
+	stats_count("threading", "jumps threaded", num_threaded);
+	stats_count("threading", "branches inverted", num_inverted);
+	stats_count("threading", "jumps to next removed", num_next);
+	stats_count("threading", "unreachable instructions removed",
+		num_unreachable);
+
+	free(is_target);
+
+	return;
+}
+
+/* Checks for an unconditional jump to a known address */
+int is_goto(instr_t* in) {
+	return in->kind == INSTR_RM && in->r == PC && in->s == PC
+		&& !strcmp(in->op, "LDA") && in->target >= 0;
+}
+
+/* Retargets a jump to the end of the chain of unconditional jumps it
+ * lands on. A chain that loops back on itself is an endless loop, and is
+ * left alone.
+ */
+int thread(int at) {
+	int n;
+	int target;
+
+	target = resolve(code[at].target);
+	for (n = 0; n < count && target < count && is_goto(&code[target]); n++) {
+		if (resolve(code[target].target) == target) break;
+		target = resolve(code[target].target);
+	}
+	if (n == count || target == resolve(code[at].target)) return 0;
+
+	code[at].target = target;
+
+	return 1;
+}
+
+/* Turns a conditional jump over an unconditional one into a jump on the
+ * opposite condition to where the unconditional one went. The jump that
+ * is jumped over must not be a target, as it is deleted.
+ */
+int invert(int at) {
+	int i;
+	int over;
+	static const char* opposite[][2] = {
+		{ "JEQ", "JNE" }, { "JNE", "JEQ" }, { "JLT", "JGE" },
+		{ "JGE", "JLT" }, { "JLE", "JGT" }, { "JGT", "JLE" },
+		{ "JZR", "JNZ" }, { "JNZ", "JZR" }, { NULL, NULL }
+	};
+
+	for (i = 0; opposite[i][0] && strcmp(opposite[i][0], code[at].op); i++);
+	if (opposite[i][0] == NULL) return 0;
+
+	over = next(at);
+	if (over >= count || !is_goto(&code[over]) || is_target[over]) return 0;
+	if (resolve(code[at].target) != next(over)) return 0;
+
+	code[at].op = (char*) opposite[i][1];
+	code[at].target = code[over].target;
+	code[over].deleted = 1;
+
+	return 1;
+}
+
+/* Deletes what cannot be reached from address 0. Control does not fall
+ * through an unconditional jump, a return through a register or HALT. An
+ * instruction writing the PC in any other way could go anywhere, so then
+ * nothing is deleted.
+ */
+int remove_unreachable() {
+	int i;
+	int n;
+	int at;
+	int* reached;
+	int* work;
+	instr_t* in;
+
+	reached = (int*) calloc(count + 1, sizeof(int));
+	work = (int*) malloc(sizeof(int) * (2 * count + 1));
+
+	n = 0;
+	work[n++] = next(-1);
+	while (n > 0) {
+		at = work[--n];
+		if (at >= count || reached[at]) continue;
+		reached[at] = 1;
+		in = &code[at];
+
+		if (in->kind == INSTR_RM && in->target >= 0) {
+			work[n++] = resolve(in->target);
+		}
+		if (in->kind == INSTR_RO && in->r == PC) {
+			free(reached);
+			free(work);
+			return 0;
+		}
+		if (in->kind == INSTR_RO && !strcmp(in->op, "HALT")) continue;
+		if (in->kind == INSTR_RM && in->r == PC && in->op[0] != 'J') {
+			continue;
+		}
+		work[n++] = next(at);
+	}
+
+	n = 0;
+	for (i = next(-1); i < count; i = next(i)) {
+		if (reached[i]) continue;
+		code[i].deleted = 1;
+		n++;
+	}
+
+	free(reached);
+	free(work);
+
+	return n;
+}
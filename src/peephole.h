@@ -0,0 +1,9 @@
+#ifndef _PEEPHOLE_H_
+#define _PEEPHOLE_H_
+
+#include "emit.h"
+
+void peephole(instr_t* code, int count);
+void thread_jumps(instr_t* code, int count);
+
+#endif /* _PEEPHOLE_H_ */
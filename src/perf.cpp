@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "perf.h"
+#include "phase.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Hardware counters are read with perf_event_open(2). Every counter is
+ * opened on its own, disabled, when profiling is enabled. It is reset and
+ * enabled when a phase begins and disabled and read when the phase ends,
+ * and the readings are summed per phase. Counters the kernel refuses to
+ * open, as in containers without perf permissions, are reported as n/a.
+ */
+
+#define NUM_COUNTERS 5
+
+typedef struct {
+	const char* name;
+	unsigned int type;
+	unsigned long long config;
+} perf_counter_t;
+
+static void report();
+static long perf_open(perf_counter_t* counter);
+
+static perf_counter_t counters[NUM_COUNTERS] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "L1D misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ "LLC misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ "branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int enabled = 0;
+static int open_errno = 0;
+static int fds[NUM_COUNTERS];
+static double totals[PHASE_COUNT][NUM_COUNTERS];
+static int measured[PHASE_COUNT];
+
+void perf_enable() {
+	int i;
+	int available;
+
+	available = 0;
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		fds[i] = (int) perf_open(&counters[i]);
+		if (fds[i] >= 0) {
+			available++;
+		} else {
+			open_errno = errno;
+		}
+	}
+
+	if (!available) {
+		fprintf(stderr, "WARNING: hardware performance counters are ");
+		fprintf(stderr, "unavailable (%s).\n", strerror(open_errno));
+		return;
+	}
+
+	enabled = 1;
+	atexit(report);
+
+	return;
+}
+
+void perf_phase_begin(phase_t phase) {
+	int i;
+
+	if (!enabled || phase == PHASE_DRIVER) return;
+
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (fds[i] < 0) continue;
+		ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+
+	return;
+}
+
+void perf_phase_end(phase_t phase) {
+	int i;
+	unsigned long long value[3];
+
+	if (!enabled || phase == PHASE_DRIVER) return;
+
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (fds[i] < 0) continue;
+		ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+		if (read(fds[i], value, sizeof(value)) != sizeof(value)) continue;
+
+		/* scale up counts that were multiplexed with other events */
+		if (value[2] > 0 && value[2] < value[1]) {
+			totals[phase][i] += (double) value[0] * value[1] / value[2];
+		} else {
+			totals[phase][i] += (double) value[0];
+		}
+	}
+	measured[phase] = 1;
+
+	return;
+}
+
+long perf_open(perf_counter_t* counter) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counter->type;
+	attr.config = counter->config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+		| PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void report() {
+	int i;
+	int p;
+
+	fprintf(stderr, "\n===========  Performance Counters  ===========\n");
+	fprintf(stderr, "%-12s", "phase");
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		fprintf(stderr, " %15s", counters[i].name);
+	}
+	fprintf(stderr, " %6s\n", "IPC");
+
+	for (p = 0; p < PHASE_COUNT; p++) {
+		if (!measured[p]) continue;
+
+		fprintf(stderr, "%-12s", phase_name((phase_t) p));
+		for (i = 0; i < NUM_COUNTERS; i++) {
+			if (fds[i] < 0) {
+				fprintf(stderr, " %15s", "n/a");
+			} else {
+				fprintf(stderr, " %15.0f", totals[p][i]);
+			}
+		}
+
+		if (fds[0] >= 0 && fds[1] >= 0 && totals[p][0] > 0) {
+			fprintf(stderr, " %6.2f\n", totals[p][1] / totals[p][0]);
+		} else {
+			fprintf(stderr, " %6s\n", "n/a");
+		}
+	}
+
+	fprintf(stderr, "===========  ==================  ===========\n");
+
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (fds[i] >= 0) close(fds[i]);
+	}
+
+	return;
+}
+
+#else
+
+void perf_enable() {
+	fprintf(stderr, "WARNING: hardware performance counters are only ");
+	fprintf(stderr, "available on Linux.\n");
+
+	return;
+}
+
+void perf_phase_begin(phase_t phase) {
+	return;
+}
+
+void perf_phase_end(phase_t phase) {
+	return;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,10 @@
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include "phase.h"
+
+void perf_enable();
+void perf_phase_begin(phase_t phase);
+void perf_phase_end(phase_t phase);
+
+#endif /* _PERF_H_ */
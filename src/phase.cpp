@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "perf.h"
+#include "phase.h"
+#include "trace.h"
+
+/* The compiler runs as a series of phases. Everything outside of a phase,
+ * such as reading the command line, belongs to the driver.
+ */
+
+static phase_t curr_phase = PHASE_DRIVER;
+
+void phase_begin(phase_t phase) {
+	curr_phase = phase;
+	perf_phase_begin(phase);
+	trace_begin("phase", phase_name(phase));
+
+	return;
+}
+
+void phase_end() {
+	perf_phase_end(curr_phase);
+	trace_end("phase", phase_name(curr_phase), 0);
+	curr_phase = PHASE_DRIVER;
+
+	return;
+}
+
+phase_t phase_current() {
+	return curr_phase;
+}
+
+const char* phase_name(phase_t phase) {
+	switch (phase) {
+		case PHASE_DRIVER:
+			return "driver";
+		case PHASE_PARSE:
+			return "scan+parse";
+		case PHASE_SEMANTIC:
+			return "semantic";
+		case PHASE_OPTIMIZE:
+			return "optimize";
+		case PHASE_CODEGEN:
+			return "codegen";
+	}
+
+	return "";
+}
@@ -0,0 +1,18 @@
+#ifndef _PHASE_H_
+#define _PHASE_H_
+
+typedef enum {
+	PHASE_DRIVER,
+	PHASE_PARSE,
+	PHASE_SEMANTIC,
+	PHASE_OPTIMIZE,
+	PHASE_CODEGEN,
+	PHASE_COUNT,
+} phase_t;
+
+void phase_begin(phase_t phase);
+void phase_end();
+phase_t phase_current();
+const char* phase_name(phase_t phase);
+
+#endif /* _PHASE_H_ */
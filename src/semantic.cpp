@@ -5,6 +5,7 @@
 #include "ast.h"
 #include "semantic.h"
 #include "symtab.h"
+#include "trace.h"
 #include "analysis/analysis.h"
 
 struct mem_data_t {
@@ -193,6 +194,7 @@ void pre_action(ast_t* node) {
 			node->data.type = TYPE_VOID;
 			break;
 		case NODE_FUNC:
+			trace_begin("semantic", node->data.name);
 			if (node->child[1]) (node->child[1])->data.is_func_body = 1;
 			if (!sem_symtab.insert(node->data.name, node)) {
 				error_symbol_defined(node);
@@ -296,6 +298,11 @@ void post_action(ast_t* node) {
 			sem_symtab.leave();
 			mem_offset.pop();
 			func_def = NULL;
+
+			if (trace_enabled()) {
+				trace_end("semantic", node->data.name, 1, "ast_nodes",
+					ast_size(node));
+			}
 			break;
 		case NODE_OP:
 			switch (node->data.op) {
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+/* Optimization passes count what they did under a pass name and a short
+ * description. The counts are printed to stderr at exit, in the order they
+ * were first seen, which is the order the passes ran in.
+ */
+
+#define MAX_STATS 128
+
+typedef struct {
+	const char* pass;
+	const char* what;
+	long count;
+} stat_t;
+
+static void report();
+
+static int enabled = 0;
+static int num_stats = 0;
+static stat_t stats[MAX_STATS];
+
+void stats_enable() {
+	if (!enabled) atexit(report);
+	enabled = 1;
+
+	return;
+}
+
+void stats_count(const char* pass, const char* what, int n) {
+	int i;
+
+	for (i = 0; i < num_stats; i++) {
+		if (!strcmp(stats[i].pass, pass) && !strcmp(stats[i].what, what)) {
+			stats[i].count += n;
+			return;
+		}
+	}
+
+	if (num_stats == MAX_STATS) return;
+
+	stats[num_stats].pass = pass;
+	stats[num_stats].what = what;
+	stats[num_stats].count = n;
+	num_stats++;
+
+	return;
+}
+
+void report() {
+	int i;
+
+	fprintf(stderr, "\n=========  Optimization Statistics  ========\n");
+
+	for (i = 0; i < num_stats; i++) {
+		fprintf(stderr, "%-12s %-32s %8li\n", stats[i].pass, stats[i].what,
+			stats[i].count);
+	}
+
+	fprintf(stderr, "===========  ==================  ===========\n");
+
+	return;
+}
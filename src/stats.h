@@ -0,0 +1,7 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+void stats_enable();
+void stats_count(const char* pass, const char* what, int n);
+
+#endif /* _STATS_H_ */
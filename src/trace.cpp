@@ -0,0 +1,107 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "trace.h"
+
+/* Writes a timeline in the Chrome trace event format, which can be loaded
+ * into chrome://tracing or Perfetto. Spans are written as matching begin
+ * and end events. Arguments given when a span ends are shown on the span.
+ */
+
+static void write_name(const char* name);
+static long now();
+static void trace_close();
+
+static FILE* trace_file = NULL;
+static long trace_start;
+static int trace_pid;
+static int num_events;
+
+int trace_open(const char* fname) {
+	trace_file = fopen(fname, "w");
+	if (trace_file == NULL) return 0;
+
+	trace_start = 0;
+	trace_start = now();
+	trace_pid = (int) getpid();
+	num_events = 0;
+
+	fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	atexit(trace_close);
+
+	return 1;
+}
+
+int trace_enabled() {
+	return trace_file != NULL;
+}
+
+void trace_begin(const char* cat, const char* name) {
+	if (trace_file == NULL) return;
+
+	fprintf(trace_file, "%s\n{\"ph\":\"B\",\"cat\":\"%s\",\"name\":",
+		num_events++ ? "," : "", cat);
+	write_name(name);
+	fprintf(trace_file, ",\"ts\":%li,\"pid\":%i,\"tid\":1}", now(), trace_pid);
+
+	return;
+}
+
+/* The arguments are nargs pairs of a (char*) name and an int value */
+void trace_end(const char* cat, const char* name, int nargs, ...) {
+	int i;
+	va_list args;
+
+	if (trace_file == NULL) return;
+
+	fprintf(trace_file, "%s\n{\"ph\":\"E\",\"cat\":\"%s\",\"name\":",
+		num_events++ ? "," : "", cat);
+	write_name(name);
+	fprintf(trace_file, ",\"ts\":%li,\"pid\":%i,\"tid\":1", now(), trace_pid);
+
+	if (nargs > 0) {
+		fprintf(trace_file, ",\"args\":{");
+		va_start(args, nargs);
+		for (i = 0; i < nargs; i++) {
+			fprintf(trace_file, "%s\"%s\":", i ? "," : "", va_arg(args, char*));
+			fprintf(trace_file, "%i", va_arg(args, int));
+		}
+		va_end(args);
+		fprintf(trace_file, "}");
+	}
+
+	fprintf(trace_file, "}");
+
+	return;
+}
+
+void write_name(const char* name) {
+	fputc('"', trace_file);
+	for (; *name; name++) {
+		if (*name == '"' || *name == '\\') fputc('\\', trace_file);
+		fputc(*name, trace_file);
+	}
+	fputc('"', trace_file);
+
+	return;
+}
+
+long now() {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000000L + tv.tv_usec - trace_start;
+}
+
+void trace_close() {
+	if (trace_file == NULL) return;
+
+	fprintf(trace_file, "\n]}\n");
+	fclose(trace_file);
+	trace_file = NULL;
+
+	return;
+}
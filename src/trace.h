@@ -0,0 +1,9 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+int trace_open(const char* fname);
+int trace_enabled();
+void trace_begin(const char* cat, const char* name);
+void trace_end(const char* cat, const char* name, int nargs, ...);
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,470 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ast.h"
+#include "stats.h"
+#include "unroll.h"
+
+/* Loop unrolling copies the body of a counted while loop, so that the test
+ * and the jump back are paid once for several iterations. A loop is counted
+ * when it compares a scalar int with a constant or an invariant variable,
+ * the last statement of its body steps that int by a constant toward the
+ * bound, and nothing else in the body assigns it or breaks out. A call may
+ * assign any global or static, so those are only counted on in a body
+ * without calls.
+ *
+ * When the statement before the loop sets the int to a constant and the
+ * bound is a constant, the trip count is known, and a loop of a few short
+ * trips becomes that many copies of its body. Otherwise a few copies of the
+ * body run in a loop whose bound is moved back by the steps of all but one
+ * copy, so that it only starts them when all of them would have run. The
+ * trips left over run in the original loop, or as plain copies of the body
+ * when there is a known number of them.
+ *
+ * Moving a variable bound back could wrap around, so the unrolled loop is
+ * skipped when the bound is that close to the end of the int range.
+ */
+
+#define UNROLL_FACTOR 4
+#define UNROLL_MAX_SIZE 64
+#define UNROLL_FULL_TRIPS 16
+#define UNROLL_FULL_SIZE 192
+
+/* The int a loop counts with steps toward the bound, which is child
+ * bound_idx of the condition
+ */
+typedef struct {
+	ast_t* var;
+	ast_t* bound;
+	int bound_idx;
+	int step;
+} counted_t;
+
+static void unroll_stmt(ast_t* stmt, ast_t* prev);
+static void unroll_loop(ast_t* loop, ast_t* prev);
+static int match_loop(ast_t* loop, counted_t* counted);
+static int match_step(ast_t* stmt, ast_t* var, int* step);
+static int trip_count(ast_t* loop, counted_t* counted, ast_t* prev,
+	long* trips);
+static int assigns(ast_t* node, ast_t* var, ast_t* skip);
+static int has_call(ast_t* node);
+static int same_var(ast_t* a, ast_t* b);
+static int is_counter(ast_t* node, ast_t* body);
+static ast_t* copies(ast_t* body, long n);
+static ast_t* new_const(int value, int lineno);
+static ast_t* new_op(ast_op_t op, const char* name, ast_type_t type,
+	ast_t* lhs, ast_t* rhs);
+static void make_block(ast_t* node, ast_t* stmts);
+
+static int num_full;
+static int num_partial;
+
+ast_t* unroll_loops(ast_t* tree) {
+	ast_t* node;
+
+	num_full = 0;
+	num_partial = 0;
+
+	for (node = tree; node; node = node->sibling) {
+		if (node->type == NODE_FUNC) unroll_stmt(node->child[1], NULL);
+	}
+
+	stats_count("unroll", "loops fully unrolled", num_full);
+	stats_count("unroll", "loops partially unrolled", num_partial);
+
+	return tree;
+}
+
+/* Unrolls the loops in a statement, innermost first. prev is the statement
+ * that runs right before it, if any.
+ */
+void unroll_stmt(ast_t* stmt, ast_t* prev) {
+	ast_t* child;
+
+	if (stmt == NULL) return;
+
+	switch (stmt->type) {
+		case NODE_COMPOUND:
+			prev = NULL;
+			for (child = stmt->child[1]; child; child = child->sibling) {
+				unroll_stmt(child, prev);
+				prev = child;
+			}
+			break;
+		case NODE_IF:
+			unroll_stmt(stmt->child[1], NULL);
+			unroll_stmt(stmt->child[2], NULL);
+			break;
+		case NODE_WHILE:
+			unroll_stmt(stmt->child[1], NULL);
+			unroll_loop(stmt, prev);
+			break;
+	}
+
+	return;
+}
+
+/* Replaces a counted loop in place with a block of its unrolled code */
+void unroll_loop(ast_t* loop, ast_t* prev) {
+	int size;
+	int factor;
+	int known;
+	long trips;
+	long steps;
+	long bound;
+	counted_t counted;
+	ast_t* orig;
+	ast_t* body;
+	ast_t* cond;
+	ast_t* guard;
+	ast_t* unrolled;
+	ast_t* first;
+
+	if (!match_loop(loop, &counted)) return;
+
+	body = loop->child[1];
+	size = ast_size(body);
+	known = trip_count(loop, &counted, prev, &trips);
+	if (known && trips == 0) return;
+
+	if (known && trips <= UNROLL_FULL_TRIPS
+		&& trips * size <= UNROLL_FULL_SIZE
+	) {
+		make_block(loop, copies(body, trips));
+		num_full++;
+		return;
+	}
+
+	factor = UNROLL_FACTOR;
+	while (factor > 1 && factor * size > UNROLL_MAX_SIZE) factor /= 2;
+	if (factor < 2) return;
+
+	/* the unrolled loop tests the bound less the steps of all but one copy */
+	steps = (long) (factor - 1) * counted.step;
+	bound = 0;
+	if (counted.bound->type == NODE_CONST) {
+		bound = ast_const_value(counted.bound) - steps;
+	}
+	if (steps < INT_MIN || steps > INT_MAX || bound < INT_MIN
+		|| bound > INT_MAX
+	) {
+		return;
+	}
+
+	/* the original loop moves to a new node, as its own becomes the block */
+	orig = ast_create_node();
+	*orig = *loop;
+	orig->sibling = NULL;
+
+	cond = ast_copy(orig->child[0]);
+	if (counted.bound->type == NODE_CONST) {
+		cond->child[counted.bound_idx]->data.int_val = bound;
+	} else {
+		cond->child[counted.bound_idx] = new_op(OP_SUB, "-", TYPE_INT,
+			ast_copy(counted.bound), new_const(steps, loop->lineno));
+	}
+
+	unrolled = ast_create_node();
+	unrolled->lineno = loop->lineno;
+	unrolled->type = NODE_WHILE;
+	ast_add_child(unrolled, 0, cond);
+	ast_add_child(unrolled, 1, copies(body, factor));
+	first = unrolled;
+
+	if (counted.bound->type != NODE_CONST) {
+		if (counted.step > 0) {
+			guard = new_op(OP_GRTEQ, ">=", TYPE_BOOL, ast_copy(counted.bound),
+				new_const(INT_MIN + steps, loop->lineno));
+		} else {
+			guard = new_op(OP_LESSEQ, "<=", TYPE_BOOL, ast_copy(counted.bound),
+				new_const(INT_MAX + steps, loop->lineno));
+		}
+		first = ast_create_node();
+		first->lineno = loop->lineno;
+		first->type = NODE_IF;
+		ast_add_child(first, 0, guard);
+		ast_add_child(first, 1, unrolled);
+	}
+
+	if (known) {
+		first->sibling = copies(body, trips % factor);
+	} else {
+		first->sibling = orig;
+	}
+
+	make_block(loop, first);
+	num_partial++;
+
+	return;
+}
+
+/* Checks whether a loop is counted, and finds what it counts with */
+int match_loop(ast_t* loop, counted_t* counted) {
+	int i;
+	int up;
+	ast_t* cond;
+	ast_t* body;
+	ast_t* last;
+
+	cond = loop->child[0];
+	body = loop->child[1];
+	if (cond->type != NODE_OP || body == NULL) return 0;
+
+	switch (cond->data.op) {
+		case OP_LESS:
+		case OP_LESSEQ:
+		case OP_GRT:
+		case OP_GRTEQ:
+			break;
+		default:
+			return 0;
+	}
+
+	last = body;
+	if (body->type == NODE_COMPOUND) {
+		last = body->child[1];
+		if (last == NULL) return 0;
+		while (last->sibling) last = last->sibling;
+	}
+
+	for (i = 0; i < 2; i++) {
+		counted->var = cond->child[i];
+		counted->bound = cond->child[1 - i];
+		counted->bound_idx = 1 - i;
+		if (match_step(last, counted->var, &counted->step)) break;
+	}
+	if (i == 2) return 0;
+
+	/* the step has to move the int toward the bound */
+	up = cond->data.op == OP_LESS || cond->data.op == OP_LESSEQ;
+	if (i == 1) up = !up;
+	if (up != (counted->step > 0)) return 0;
+
+	if (!is_counter(counted->var, body)) return 0;
+	if (assigns(body, counted->var, last)) return 0;
+	if (ast_has_break(body)) return 0;
+
+	if (counted->bound->type == NODE_CONST) {
+		return counted->bound->data.type == TYPE_INT;
+	}
+
+	return is_counter(counted->bound, body)
+		&& !same_var(counted->bound, counted->var)
+		&& !assigns(body, counted->bound, NULL);
+}
+
+/* Checks whether a statement steps a variable by a constant, as in i++,
+ * i -= 2 or i = i + 2
+ */
+int match_step(ast_t* stmt, ast_t* var, int* step) {
+	int negate;
+	ast_t* rhs;
+	ast_t* value;
+
+	if (stmt->type != NODE_ASSIGN || !same_var(stmt->child[0], var)) {
+		return 0;
+	}
+
+	rhs = stmt->child[1];
+	negate = 0;
+	switch (stmt->data.op) {
+		case OP_INC:
+			*step = 1;
+			return 1;
+		case OP_DEC:
+			*step = -1;
+			return 1;
+		case OP_ADDASS:
+			value = rhs;
+			break;
+		case OP_SUBASS:
+			value = rhs;
+			negate = 1;
+			break;
+		case OP_ASS:
+			if (rhs->type != NODE_OP) return 0;
+			if (rhs->data.op == OP_ADD && same_var(rhs->child[0], var)) {
+				value = rhs->child[1];
+			} else if (rhs->data.op == OP_ADD
+				&& same_var(rhs->child[1], var)
+			) {
+				value = rhs->child[0];
+			} else if (rhs->data.op == OP_SUB
+				&& same_var(rhs->child[0], var)
+			) {
+				value = rhs->child[1];
+				negate = 1;
+			} else {
+				return 0;
+			}
+			break;
+		default:
+			return 0;
+	}
+
+	if (value->type != NODE_CONST || value->data.type != TYPE_INT) return 0;
+	if (value->data.int_val == 0 || value->data.int_val == INT_MIN) return 0;
+
+	*step = negate ? -value->data.int_val : value->data.int_val;
+
+	return 1;
+}
+
+/* Finds how many times a loop runs when the statement before it sets the
+ * int it counts with to a constant, and the bound is a constant too.
+ * Returns 0 if that is not known.
+ */
+int trip_count(ast_t* loop, counted_t* counted, ast_t* prev, long* trips) {
+	int strict;
+	long start;
+	long limit;
+	long end;
+
+	if (counted->bound->type != NODE_CONST || prev == NULL) return 0;
+	if (prev->type != NODE_ASSIGN || prev->data.op != OP_ASS
+		|| !same_var(prev->child[0], counted->var)
+		|| prev->child[1]->type != NODE_CONST
+	) {
+		return 0;
+	}
+
+	start = ast_const_value(prev->child[1]);
+	limit = ast_const_value(counted->bound);
+	strict = loop->child[0]->data.op == OP_LESS
+		|| loop->child[0]->data.op == OP_GRT;
+
+	/* the last value that passes the test */
+	if (counted->step > 0) {
+		if (strict) limit--;
+		*trips = start > limit ? 0 : (limit - start) / counted->step + 1;
+	} else {
+		if (strict) limit++;
+		*trips = start < limit ? 0 : (start - limit) / -counted->step + 1;
+	}
+
+	/* a count that wraps around is left alone */
+	end = start + *trips * counted->step;
+
+	return end >= INT_MIN && end <= INT_MAX;
+}
+
+/* Checks for an assignment to a variable in a subtree, other than skip */
+int assigns(ast_t* node, ast_t* var, ast_t* skip) {
+	int i;
+
+	for (; node; node = node->sibling) {
+		if (node == skip) continue;
+		if (node->type == NODE_ASSIGN && same_var(node->child[0], var)) {
+			return 1;
+		}
+		for (i = 0; i < node->num_children; i++) {
+			if (assigns(node->child[i], var, skip)) return 1;
+		}
+	}
+
+	return 0;
+}
+
+int has_call(ast_t* node) {
+	int i;
+
+	for (; node; node = node->sibling) {
+		if (node->type == NODE_CALL) return 1;
+		for (i = 0; i < node->num_children; i++) {
+			if (has_call(node->child[i])) return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Checks whether two nodes name the same scalar, by its base register and
+ * offset
+ */
+int same_var(ast_t* a, ast_t* b) {
+	int a_frame;
+	int b_frame;
+
+	if (a->type != NODE_ID || b->type != NODE_ID) return 0;
+	if (a->data.is_array || b->data.is_array) return 0;
+
+	a_frame = a->data.mem.scope == SCOPE_LOCAL
+		|| a->data.mem.scope == SCOPE_PARAM;
+	b_frame = b->data.mem.scope == SCOPE_LOCAL
+		|| b->data.mem.scope == SCOPE_PARAM;
+
+	return a_frame == b_frame && a->data.mem.loc == b->data.mem.loc;
+}
+
+/* Checks whether a variable can count a loop or bound it: a scalar int
+ * that no call in the loop body can assign
+ */
+int is_counter(ast_t* node, ast_t* body) {
+	if (node->type != NODE_ID || node->data.is_array) return 0;
+	if (node->data.type != TYPE_INT) return 0;
+
+	return node->data.mem.scope == SCOPE_LOCAL
+		|| node->data.mem.scope == SCOPE_PARAM || !has_call(body);
+}
+
+ast_t* copies(ast_t* body, long n) {
+	ast_t* list;
+	ast_t* copy;
+
+	list = NULL;
+	for (; n > 0; n--) {
+		copy = ast_copy(body);
+		copy->sibling = list;
+		list = copy;
+	}
+
+	return list;
+}
+
+ast_t* new_const(int value, int lineno) {
+	ast_t* node;
+
+	node = ast_create_node();
+	node->lineno = lineno;
+	node->type = NODE_CONST;
+	node->data.type = TYPE_INT;
+	node->data.is_const = 1;
+	node->data.int_val = value;
+
+	return node;
+}
+
+ast_t* new_op(ast_op_t op, const char* name, ast_type_t type, ast_t* lhs,
+	ast_t* rhs
+) {
+	ast_t* node;
+
+	node = ast_create_node();
+	node->lineno = lhs->lineno;
+	node->type = NODE_OP;
+	node->data.name = (char*) name;
+	node->data.type = type;
+	node->data.op = op;
+	ast_add_child(node, 0, lhs);
+	ast_add_child(node, 1, rhs);
+
+	return node;
+}
+
+/* Turns a statement into a block of other statements in place, keeping its
+ * place in the list
+ */
+void make_block(ast_t* node, ast_t* stmts) {
+	int i;
+
+	node->type = NODE_COMPOUND;
+	node->data.type = TYPE_VOID;
+	for (i = 0; i < node->num_children; i++) {
+		node->child[i] = NULL;
+	}
+	node->num_children = 0;
+	ast_add_child(node, 0, NULL);
+	ast_add_child(node, 1, stmts);
+
+	return;
+}
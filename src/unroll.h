@@ -0,0 +1,8 @@
+#ifndef _UNROLL_H_
+#define _UNROLL_H_
+
+#include "ast.h"
+
+ast_t* unroll_loops(ast_t* tree);
+
+#endif /* _UNROLL_H_ */
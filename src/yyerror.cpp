@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <map>
 #include <string>
+#include "ast.h"
 #include "yyerror.h"
 
 // // // // // // // // // // // // // // // // // // // // 
@@ -167,7 +168,9 @@ void yyerror(const char *msg)
     }
 
     // print components
-    printf("ERROR(%d): Syntax error, unexpected %s", yylineno, strs[3]);
+    if (ast_filename) printf("ERROR(%s:%d): ", ast_filename, yylineno);
+    else printf("ERROR(%d): ", yylineno);
+    printf("Syntax error, unexpected %s", strs[3]);
     if (elaborate(strs[3])) {
         if (yytext[0]=='\'' || yytext[0]=='"') printf(" %s", yytext); 
         else printf(" \'%s\'", yytext);